@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
 
 #include <pthread.h>
 #include <unistd.h>
@@ -8,6 +10,7 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 
 
 //net
@@ -17,6 +20,18 @@
 //net app
 #define MAX_EVENTS 10000
 #define CLIENT_MESSAGE_SIZE 1024
+#define CONN_BUFFER_SIZE (16 * CLIENT_MESSAGE_SIZE)    // read ahead per connection, echoed with one send
+
+// per epoll instance busy polling, kernel 6.9. older headers don't have it
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
 
 
 typedef struct {
@@ -25,20 +40,141 @@ typedef struct {
 }
 thread_params;
 
+typedef struct {
+    int reuseport;              // one SO_REUSEPORT listener per thread instead of a shared EPOLLEXCLUSIVE one
+    unsigned busy_poll_usec;    // SO_BUSY_POLL on connections and busy polling epoll_wait, 0 = off
+}
+server_config_t;
+
+server_config_t server_config;
+
+// bytes read and not echoed yet. while any are pending nothing more is read,
+// a peer that stops reading stops being read from
+typedef struct {
+    int socket;
+    unsigned head;      // first byte not sent
+    unsigned tail;      // end of the bytes read
+    char buffer[CONN_BUFFER_SIZE];
+}
+connection;
+
+
+
+void busy_poll_setup(int epollfd, int thread_num)
+{
+    struct epoll_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = server_config.busy_poll_usec;
+    params.busy_poll_budget = 8;
+    params.prefer_busy_poll = 1;
+
+    if (ioctl(epollfd, EPIOCSPARAMS, &params) < 0 && thread_num == 0) {
+        perror("EPIOCSPARAMS failed, epoll_wait busy polls only with net.core.busy_poll set \n");
+    }
+}
 
+// accepts until the backlog is empty, the listener may be shared with other threads
+void accept_all(int epollfd, int sock_listen)
+{
+    struct epoll_event ev;
+    int new_sock;
+
+    while ((new_sock = accept4(sock_listen, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        connection* conn = malloc(sizeof(connection));
+        conn->socket = new_sock;
+        conn->head = conn->tail = 0;
 
+        if (server_config.busy_poll_usec) {
+            setsockopt(new_sock, SOL_SOCKET, SO_BUSY_POLL, &server_config.busy_poll_usec, sizeof(server_config.busy_poll_usec));
+        }
+
+        // both directions once, edge triggered: EPOLLOUT only matters while a reply is pending
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, new_sock, &ev) == -1) {
+            perror("epoll_ctl ADD failed \n");
+            close(new_sock);
+            free(conn);
+        }
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("accept failed \n");
+    }
+}
+
+// flushes the pending reply, then reads until EAGAIN and echoes all of it with one send.
+// returns -1 if the connection is done
+int conn_echo(connection* conn)
+{
+    while (1)
+    {
+        if (conn->head < conn->tail) {
+            int sent = send(conn->socket, conn->buffer + conn->head, conn->tail - conn->head, MSG_NOSIGNAL);
+
+            if (sent < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            }
+
+            conn->head += sent;
+            if (conn->head < conn->tail) {
+                // socket buffer full, EPOLLOUT continues
+                return 0;
+            }
+            conn->head = conn->tail = 0;
+        }
+
+        int drained = 0;
+
+        while (conn->tail < CONN_BUFFER_SIZE) {
+            int bytes_read = recv(conn->socket, conn->buffer + conn->tail, CONN_BUFFER_SIZE - conn->tail, 0);
+
+            if (bytes_read == 0) {
+                return -1;
+            }
+            if (bytes_read < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return -1;
+                }
+                drained = 1;
+                break;
+            }
+            conn->tail += bytes_read;
+        }
+
+        if (conn->tail == 0) {
+            return 0;
+        }
+
+        // with the reply out and the socket drained the next edge brings us back
+        if (drained) {
+            int sent = send(conn->socket, conn->buffer, conn->tail, MSG_NOSIGNAL);
+
+            if (sent < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            }
+
+            conn->head = sent;
+            if (conn->head == conn->tail) {
+                conn->head = conn->tail = 0;
+            }
+            return 0;
+        }
+    }
+}
 
 void* launch_epoll(void *arg) {
 
     int sock_listen = ((int*)arg)[0];
-    int thread_num = ((int*)arg)[1]; 
+    int thread_num = ((int*)arg)[1];
 
     cpu_set_t cpuset;
     pthread_t thread;
 
     thread = pthread_self();
     CPU_ZERO(&cpuset);
-    CPU_SET(thread_num, &cpuset);
+    CPU_SET(thread_num % sysconf(_SC_NPROCESSORS_ONLN), &cpuset);
 
     int res = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
     if (res != 0) {
@@ -46,155 +182,166 @@ void* launch_epoll(void *arg) {
        return NULL;
     }
 
-    struct sockaddr_in cli_addr;
-    socklen_t addr_len = sizeof(struct sockaddr_in);
-    memset(&cli_addr, 0, addr_len);
-    
-    char buffer[CLIENT_MESSAGE_SIZE];
-    memset(buffer, 0, sizeof(buffer));
-
 
     struct epoll_event ev;
     struct epoll_event events[MAX_EVENTS];
     int epollfd;
-    
-    epollfd = epoll_create(1);
+
+    // one epoll per thread, connections stay on the thread that accepted them
+    epollfd = epoll_create1(0);
     if (epollfd < 0) {
         perror("Creating epoll FD failed \n");
+        return NULL;
     }
 
-    ev.events = EPOLLIN;
-    ev.data.fd = sock_listen;
+    if (server_config.busy_poll_usec) {
+        busy_poll_setup(epollfd, thread_num);
+    }
+
+    // a shared listener wakes one waiting thread per connection instead of all of them
+    ev.events = server_config.reuseport ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
 
     if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sock_listen, &ev) == -1) {
         perror("Adding listening socket failed \n");
+        return NULL;
     }
 
     int total_events;
-    int new_sock;
-    int bytes_read;
 
     // main io loop
     while (1)
     {
         total_events = epoll_wait(epollfd, events, MAX_EVENTS, -1);
-        
+
         if (total_events == -1) {
-            perror("epoll_wait failed \n");
+            if (errno != EINTR) {
+                perror("epoll_wait failed \n");
+            }
+            continue;
         }
 
         for (int i = 0; i < total_events; ++i) {
-            if (events[i].data.fd == sock_listen) {
-                //printf("ACCEPT SOCKET# %i in thread# %i \n", res, thread_num);
-                //fflush(stdout);
-
-                new_sock = accept4(sock_listen, (struct sockaddr *)&cli_addr, &addr_len, SOCK_NONBLOCK);
-                
-                if (new_sock > 0) {
-                    ev.events = EPOLLIN | EPOLLET;
-                    ev.data.fd = new_sock;
-                    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, new_sock, &ev) == -1){
-                        perror("epoll_ctl ADD failed \n");
-                    }
-                }
-
+            connection* conn = events[i].data.ptr;
 
+            if (conn == NULL) {
+                accept_all(epollfd, sock_listen);
             }
-            else {
-                new_sock = events[i].data.fd;
-                bytes_read = recv(new_sock, buffer, CLIENT_MESSAGE_SIZE, 0);
-                if (bytes_read <= 0){
-                    epoll_ctl(epollfd, EPOLL_CTL_DEL, new_sock, NULL);
-                    shutdown(new_sock, SHUT_RDWR);
-                }
-                else{
-                    send(new_sock, buffer, bytes_read, 0);
-                }
+            else if (conn_echo(conn) < 0) {
+                // close drops it from the epoll set
+                close(conn->socket);
+                free(conn);
             }
         }
     }
 }
 
 
+int listen_socket(struct sockaddr_in* srv_addr)
+{
+    int sock_listen;
+    int reuse_val = 1;
+
+    sock_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(sock_listen, SOL_SOCKET, SO_REUSEADDR, &reuse_val, sizeof(reuse_val));
+
+    if (server_config.reuseport) {
+        setsockopt(sock_listen, SOL_SOCKET, SO_REUSEPORT, &reuse_val, sizeof(reuse_val));
+    }
+
+    if (bind(sock_listen, (struct sockaddr *)srv_addr, sizeof(*srv_addr)) < 0) {
+        perror("binding socket failed \n");
+        return -1;
+    }
+
+    if (listen(sock_listen, LISTEN_BACKLOG) < 0) {
+        perror("listening failed\n");
+        return -1;
+    }
+    return sock_listen;
+}
 
 
 int main(int argc, char* argv[])
 {
     // parse params
-    int opt; 
+    int opt;
     long threads = 0;
 
-    while((opt = getopt(argc, argv, "t:h")) != -1)  
-    {  
-        switch(opt)  
-        {  
-            case 't':  
-                threads = strtol(optarg, NULL, 10); 
+    while((opt = getopt(argc, argv, "t:rp:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                threads = strtol(optarg, NULL, 10);
                 if (threads < 1 || threads > 64) {
                    printf("Threads value must be > 0 and < 64 \n");
                    return 1;
                 }
-                break;  
-            case 'h':  
-                printf("usage -t: number of threads. defaults to # of CPUs in the system \n"); 
-                return 0;  
-        }  
+                break;
+            case 'r':
+                server_config.reuseport = 1;
+                break;
+            case 'p':
+                server_config.busy_poll_usec = strtol(optarg, NULL, 10);
+                break;
+            case 'h':
+                printf("usage -t: number of threads. defaults to # of CPUs in the system \n");
+                printf("      -r: one SO_REUSEPORT listener per thread. default is one listener shared with EPOLLEXCLUSIVE \n");
+                printf("      -p: busy poll this many usec, SO_BUSY_POLL on connections and in epoll_wait. may need CAP_NET_ADMIN \n");
+                return 0;
+        }
     }
 
 
     long total_cpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-    printf("IO_URING test echo server. \n");
+    printf("EPOLL test echo server. \n");
     printf("Number of CPUs: %li \n", total_cpu);
 
     if (threads == 0) {
        threads = total_cpu;
-    } 
- 
-    printf("Launching with %li threads. \n", threads);
+    }
 
+    printf("Launching with %li threads, %s listener%s. \n", threads,
+           server_config.reuseport ? "SO_REUSEPORT" : "shared EPOLLEXCLUSIVE",
+           server_config.reuseport ? "s" : "");
 
-    struct sockaddr_in srv_addr;
-    int sock_listen;
-    int reuse_val = 1;
+    if (server_config.busy_poll_usec) {
+        printf("Busy polling for %u usec \n", server_config.busy_poll_usec);
+    }
 
-    memset(&srv_addr, 0, sizeof(srv_addr));
 
+    struct sockaddr_in srv_addr;
+    int sock_listen = -1;
 
-    // create main listening socket
-    sock_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    setsockopt(sock_listen, SOL_SOCKET, SO_REUSEADDR, &reuse_val, sizeof(reuse_val));
+    memset(&srv_addr, 0, sizeof(srv_addr));
 
     srv_addr.sin_family = AF_INET;
     srv_addr.sin_port = htons(LISTEN_PORT);
     srv_addr.sin_addr.s_addr = INADDR_ANY;
 
 
-    // bind main listening socket
-    if (bind(sock_listen, (struct sockaddr *)&srv_addr, sizeof(srv_addr)) < 0) {
-        perror("binding socket failed \n");
-        return 1;
-    }
-
-    // start listening
-    if (listen(sock_listen, LISTEN_BACKLOG) < 0) {
-        perror("listening failed\n");
-        return 1;
-    }
-
-
     //launch IO threads
     thread_params* tp_arr;
-    pthread_t* t_ids; 
+    pthread_t* t_ids;
 
     tp_arr = malloc(sizeof(thread_params) * threads);
-    t_ids = malloc(sizeof(pthread_t) * threads);    
+    t_ids = malloc(sizeof(pthread_t) * threads);
 
     for (int i=0; i<threads; i++) {
+       // the kernel spreads connections over the reuseport group, no shared accept queue
+       if (server_config.reuseport || i == 0) {
+           sock_listen = listen_socket(&srv_addr);
+           if (sock_listen < 0) {
+               return 1;
+           }
+       }
+
        tp_arr[i].listener_socket = sock_listen;
        tp_arr[i].thread_num = i;
        pthread_create(&t_ids[i], NULL, &launch_epoll, (void*)&tp_arr[i]);
-    }    
+    }
 
     printf("server running...\n");
 
@@ -203,4 +350,4 @@ int main(int argc, char* argv[])
        pthread_join(t_ids[i], (void**)&ret);
     }
 
-}
\ No newline at end of file
+}
@@ -3,287 +3,1425 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
-#include <sys/syscall.h>
-#include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/resource.h>
 
-#include <linux/io_uring.h> //kernel 5.1 required
-
-#define __NR_io_uring_setup 425
-#define __NR_io_uring_enter 426
+#include "raw_ring.h"
+#include "crc32c.h"
 
 #define URING_QUEUE_SIZE  1024
 
-#define rmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
-#define wmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
+#define CHUNK_SIZE_KB 1024      // default range read size
+#define QUEUE_DEPTH 32          // default reads in flight across all files
+#define MAX_DEPTHS 16           // queue depths compared in one run
+#define DIRECT_ALIGN 4096       // O_DIRECT offsets, lengths and buffers are multiples of this
+#define SMALL_CHAIN_LEN 4       // SQEs per file in small-file mode
+
+struct io_chunk;
+struct digest;
 
 struct io_file_data {
     char* filename;
+    int fd;
     off_t filesize;
-    struct iovec* iov;      
+    off_t next_offset;          // start of the next range to read
+    off_t delivered;            // bytes handed to the consumer so far, always in file order
+    unsigned inflight;
+    struct io_chunk* completed; // read but not delivered yet, sorted by offset
+    uint32_t crc;               // checksum mode: the raw CRCs of the chunks hashed so far
+    off_t hashed;
+    unsigned hash_jobs;         // chunks with the hash workers
+    struct digest* digest;      // its place in the digest output, taken with the first chunk
+    int dropped;                // tree mode is done with it, freed by the last hashed chunk
 };
 
-
-struct app_sq_ring {
-    unsigned* head;
-    unsigned* tail;
-    unsigned* ring_mask;
-    unsigned* ring_entries;
-    unsigned* flags;
-    unsigned* array;
+// one range read, owns a buffer from the pool while in flight or waiting for delivery
+struct io_chunk {
+    struct io_file_data* file;
+    off_t offset;
+    unsigned len;
+    unsigned done;              // bytes read so far, short reads are resubmitted for the rest
+    struct iovec iov;
+    char* buffer;
+    unsigned index;             // registered buffer index, direct mode
+    uint32_t crc;               // checksum mode: hashed by a worker
+    off_t trailing;             // file bytes after this chunk
+    struct io_chunk* next;      // free list, the file's completed list or the hash queues
 };
 
-struct app_cq_ring {
-    unsigned* head;
-    unsigned* tail;
-    unsigned* ring_mask;
-    unsigned* ring_entries;
-    struct io_uring_cqe* cqes;
-};
+// gets every file's bytes exactly once, chunk by chunk in file order. returns 1 if it keeps the
+// buffer, it then goes back to the pool through release_chunk() later
+typedef int (*chunk_consumer)(struct io_file_data* file, off_t offset, const char* data, unsigned len);
 
 
-//global app references to uring interface
-int uring_fd;
-struct app_sq_ring _sq;
-struct app_cq_ring _cq;
-struct io_uring_sqe* _sqes;
+//global app reference to uring interface
+struct raw_ring ring;
 
+//streaming state
+unsigned chunk_size = CHUNK_SIZE_KB * 1024;
+unsigned pool_size;                 // buffers, bounds memory use to pool_size * chunk_size
+struct io_chunk* chunk_pool;
+struct io_chunk* free_chunks;
+unsigned to_submit;                 // SQEs published since the last io_uring_enter
+unsigned long enters;               // io_uring_enter calls, one per submitted batch
+unsigned inflight;
+unsigned long reads_completed;      // CQEs, short reads count twice
 
-// these are not in the linux c library yet
-int io_uring_setup(unsigned entries, struct io_uring_params *p)
-{
-    return (int) syscall(__NR_io_uring_setup, entries, p);
-}
-
-int io_uring_enter(int ring_fd, unsigned int to_submit,unsigned int min_complete, unsigned int flags)
-{
-    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
-}
-
+//page cache bypass: O_DIRECT files read with READ_FIXED into the registered pool
+int direct_io;
+int fixed_buffers;                  // READ_FIXED into the registered pool, implied by direct_io
+int polled_io;                      // IORING_SETUP_IOPOLL, completions are polled from the device
 
 
 //  init uring interface
-int init_uring() {
+int init_uring(unsigned flags) {
     struct io_uring_params p;
     memset(&p, 0, sizeof(p));
+    p.flags = flags;
 
-    uring_fd = io_uring_setup(URING_QUEUE_SIZE, &p); 
-    if (uring_fd < 0) {
-        perror("io_uring_setup failed");
+    int res = ring_init(&ring, URING_QUEUE_SIZE, &p);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-res));
         return 1;
     }
+    return 0;
+}
+
 
-    void* ptr;
 
-    //mapping submission queue 
-    ptr = mmap(0, p.sq_off.array + p.sq_entries * sizeof(__u32), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed for submission queue");
+// one contiguous allocation, page aligned, chunks handed out and recycled through a free list
+int init_pool(unsigned buffers) {
+    char* memory;
+
+    if (posix_memalign((void**)&memory, 4096, (size_t)buffers * chunk_size)) {
+        fprintf(stderr, "buffer pool allocation failed: %u x %u bytes\n", buffers, chunk_size);
         return 1;
     }
 
-    //save for easier reference
-    _sq.head = ptr + p.sq_off.head;
-    _sq.tail = ptr + p.sq_off.tail;
-    _sq.ring_mask = ptr + p.sq_off.ring_mask;
-    _sq.ring_entries = ptr + p.sq_off.ring_entries;
-    _sq.flags = ptr + p.sq_off.flags;
-    _sq.array = ptr + p.sq_off.array;
+    chunk_pool = calloc(buffers, sizeof(struct io_chunk));
+    pool_size = buffers;
+    free_chunks = NULL;
+
+    for (unsigned i = 0; i < buffers; i++) {
+        chunk_pool[i].buffer = memory + (size_t)i * chunk_size;
+        chunk_pool[i].index = i;
+        chunk_pool[i].next = free_chunks;
+        free_chunks = &chunk_pool[i];
+    }
+    return 0;
+}
 
+// pins the pool once, READ_FIXED then skips mapping the user pages on every read
+int register_pool() {
+    struct iovec* iovs = malloc(sizeof(struct iovec) * pool_size);
 
-    //mapping submission queue entries
-    _sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_SQES);
-    if (_sqes == MAP_FAILED) {
-        perror("mmap failed for submission queue entries");
+    for (unsigned i = 0; i < pool_size; i++) {
+        iovs[i].iov_base = chunk_pool[i].buffer;
+        iovs[i].iov_len = chunk_size;
+    }
+
+    int res = sys_io_uring_register(ring.fd, IORING_REGISTER_BUFFERS, iovs, pool_size);
+    free(iovs);
+
+    if (res < 0) {
+        perror("io_uring_register buffers failed, RLIMIT_MEMLOCK may be too low");
         return 1;
     }
+    return 0;
+}
+
+void release_chunk(struct io_chunk* chunk) {
+    chunk->next = free_chunks;
+    free_chunks = chunk;
+}
+
+
+
+// fills in the read, the kernel sees it with the next ring_flush()
+int submit_sqe(struct io_chunk* chunk) {
+    chunk->iov.iov_base = chunk->buffer + chunk->done;
+    chunk->iov.iov_len = chunk->len - chunk->done;
+
+    // never full, reads in flight are capped by the depth
+    struct io_uring_sqe *sqe = ring_get_sqe(&ring);
+
+    sqe->fd = chunk->file->fd;
+    sqe->flags = 0;
+    if (fixed_buffers) {
+        // with O_DIRECT the last range of a file is rounded up, the read stops at EOF
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long) chunk->iov.iov_base;
+        sqe->len = direct_io ? (chunk->iov.iov_len + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1) : chunk->iov.iov_len;
+        sqe->buf_index = chunk->index;
+    }
+    else {
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (unsigned long) &chunk->iov;
+        sqe->len = 1; //only one iov element
+    }
+    sqe->off = chunk->offset + chunk->done;
+    sqe->user_data = (unsigned long long) chunk;
 
+    inflight++;
+    chunk->file->inflight++;
+
+    return 0;
+}
 
-    //mapping completion queue 
-    ptr = mmap(0, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_CQ_RING);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed for completion queue");
+// takes the next range of a file and queues its read, 1 if the file has nothing left to read
+int submit_chunk(struct io_file_data* file) {
+    if (file->next_offset >= file->filesize) {
         return 1;
     }
 
-    //save for easier reference
-    _cq.head = ptr + p.cq_off.head;
-    _cq.tail = ptr + p.cq_off.tail;
-    _cq.ring_mask = ptr + p.cq_off.ring_mask;
-    _cq.ring_entries = ptr + p.cq_off.ring_entries;
-    _cq.cqes = ptr + p.cq_off.cqes;
+    struct io_chunk* chunk = free_chunks;
+    free_chunks = chunk->next;
+
+    chunk->file = file;
+    chunk->offset = file->next_offset;
+    chunk->len = file->filesize - file->next_offset < chunk_size ? file->filesize - file->next_offset : chunk_size;
+    chunk->done = 0;
+    chunk->next = NULL;
+    file->next_offset += chunk->len;
+
+    return submit_sqe(chunk);
+}
+
+
+
+// hands over the completed chunks that continue the file, in order, and recycles their buffers
+void deliver(struct io_file_data* file, chunk_consumer consumer) {
+    while (file->completed && file->completed->offset == file->delivered) {
+        struct io_chunk* chunk = file->completed;
+        file->completed = chunk->next;
+
+        file->delivered += chunk->len;
+        if (!consumer(file, chunk->offset, chunk->buffer, chunk->len)) {
+            release_chunk(chunk);
+        }
+    }
+}
+
+// keeps the completed list sorted, chunks of one file may complete in any order
+void park_chunk(struct io_chunk* chunk) {
+    struct io_chunk** pos = &chunk->file->completed;
+
+    while (*pos && (*pos)->offset < chunk->offset) {
+        pos = &(*pos)->next;
+    }
+    chunk->next = *pos;
+    *pos = chunk;
+}
+
+// returns the number of files finished, -1 on a read error
+int read_cqe(chunk_consumer consumer) {
+    struct io_chunk* chunk;
+    struct io_uring_cqe* cqe;
+    unsigned head, tail;
+    int files_done = 0;
+
+    head = ring_cq_head(&ring);
+    tail = ring_cq_tail(&ring);
+
+    for (; head != tail; head++) {
+        // read completed entry
+        cqe = ring_cqe_at(&ring, head);
+        chunk = (struct io_chunk*) cqe->user_data;
+
+        inflight--;
+        chunk->file->inflight--;
+        reads_completed++;
+
+        if (cqe->res < 0) {
+            fprintf(stderr, "readv error: %s, file %s at %li\n", strerror(-cqe->res), chunk->file->filename, (long)chunk->offset);
+            if (polled_io && cqe->res == -EOPNOTSUPP) {
+                fprintf(stderr, "polled reads need a block device with poll queues, e.g. nvme.poll_queues > 0\n");
+            }
+            files_done = -1;
+            head++;
+            break;
+        }
+
+        if (cqe->res == 0) {
+            fprintf(stderr, "file %s shrank while reading, %li bytes short\n", chunk->file->filename, (long)(chunk->len - chunk->done));
+            files_done = -1;
+            head++;
+            break;
+        }
+
+        chunk->done += cqe->res;
+        if (chunk->done < chunk->len) {
+            // short read, the rest of the range goes back in
+            submit_sqe(chunk);
+            continue;
+        }
+
+        struct io_file_data* file = chunk->file;
+        park_chunk(chunk);
+        deliver(file, consumer);
+
+        if (file->delivered == file->filesize) {
+            close(file->fd);
+            files_done++;
+        }
+    }
+
+    // one head update for the whole drain
+    ring_cq_advance(&ring, head);
+
+    return files_done;
+}
+
+
+
+// default consumer, prints the last 10 chars or less of every file
+int print_tail(struct io_file_data* file, off_t offset, const char* data, unsigned len) {
+    if (offset + len < file->filesize) {
+        return 0;
+    }
+
+    printf("File: %s, %li bytes\n", file->filename, (long)file->filesize);
+    if (len > 10) {
+        printf("%.10s", &data[len-10]);
+    } else {
+        printf("%.*s", len, data);
+    }
+    printf("\n");
+    return 0;
+}
 
+// benchmark consumer, the data is dropped
+int discard_chunk(struct io_file_data* file, off_t offset, const char* data, unsigned len) {
     return 0;
 }
 
 
 
+// checksum pipeline: delivered chunks go to hashing threads while the ring thread reads on into the
+// free buffers. a file's chunks are hashed in any order, their raw CRC32Cs are shifted past the
+// bytes after them and XORed together, see crc32c.h
+int checksum;
+unsigned hash_workers;              // 0 hashes on the ring thread, read and hash one after the other
+int print_digests;
 
-int submit_sqe(char *filename) {
-    struct stat st;
-    struct io_file_data* fdata;
+struct hash_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t work;            // workers wait for chunks
+    pthread_cond_t hashed;          // the ring thread waits for buffers
+    struct io_chunk* todo;
+    struct io_chunk* todo_tail;
+    struct io_chunk* done;
+    unsigned pending;               // chunks with the workers
+};
 
-    fdata = malloc(sizeof(struct io_file_data));
+struct hash_queue hq = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .hashed = PTHREAD_COND_INITIALIZER,
+};
 
-    fdata->iov = malloc(sizeof(struct iovec));
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr,"file open error: %s \n", filename);
-        return 1;
+// digests are printed in the order the files were opened for streaming or, for small-file chains,
+// delivered, which is argument order with -o. a file hashed before the ones ahead of it waits here
+// with its digest until they are out
+struct digest {
+    char* filename;
+    uint32_t crc;
+    int done;
+    struct digest* next;
+};
+
+struct digest* digests;
+struct digest* digests_tail;
+
+pthread_t* hash_threads;
+unsigned long hash_outstanding;     // handed to the workers and not reclaimed yet, ring thread only
+double hash_starved;                // seconds the ring thread had no buffer because all were being hashed
+double hash_inline;                 // seconds spent hashing on the ring thread with no workers
+
+
+double now_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// chunk->crc is the raw CRC moved to the end of the file
+void hash_buffer(struct io_chunk* chunk, const char* data) {
+    chunk->crc = crc32c_shift(crc32c_raw(0, data, chunk->len), chunk->trailing);
+}
+
+void* hash_worker(void* arg) {
+    while (1) {
+        pthread_mutex_lock(&hq.lock);
+        while (hq.todo == NULL) {
+            pthread_cond_wait(&hq.work, &hq.lock);
+        }
+        struct io_chunk* chunk = hq.todo;
+        hq.todo = chunk->next;
+        pthread_mutex_unlock(&hq.lock);
+
+        hash_buffer(chunk, chunk->buffer);
+
+        pthread_mutex_lock(&hq.lock);
+        chunk->next = hq.done;
+        hq.done = chunk;
+        hq.pending--;
+        pthread_cond_signal(&hq.hashed);
+        pthread_mutex_unlock(&hq.lock);
+    }
+    return NULL;
+}
+
+int start_hash_workers() {
+    hash_threads = malloc(sizeof(pthread_t) * hash_workers);
+
+    for (unsigned i = 0; i < hash_workers; i++) {
+        if (pthread_create(&hash_threads[i], NULL, hash_worker, NULL)) {
+            perror("starting hash workers failed \n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// CPU time of all hash workers so far
+double hash_worker_seconds() {
+    double total = 0;
+
+    for (unsigned i = 0; i < hash_workers; i++) {
+        clockid_t clock;
+        struct timespec ts;
+
+        if (pthread_getcpuclockid(hash_threads[i], &clock) == 0 && clock_gettime(clock, &ts) == 0) {
+            total += ts.tv_sec + ts.tv_nsec / 1e9;
+        }
+    }
+    return total;
+}
+
+// queues the file's digest line, the file itself may be gone by the time it's printed
+struct digest* digest_push(struct io_file_data* file) {
+    struct digest* d = calloc(1, sizeof(struct digest));
+
+    d->filename = strdup(file->filename);
+    if (digests) {
+        digests_tail->next = d;
+    } else {
+        digests = d;
+    }
+    digests_tail = d;
+    return d;
+}
+
+// prints the finished digests at the head of the queue
+void digest_flush() {
+    while (digests && digests->done) {
+        struct digest* d = digests;
+
+        printf("%08x  %s\n", d->crc, d->filename);
+        digests = d->next;
+        free(d->filename);
+        free(d);
+    }
+}
+
+// empty files are never delivered, their digest is the CRC32C of nothing
+void hash_empty(struct io_file_data* file) {
+    if (print_digests) {
+        if (file->digest == NULL) {
+            file->digest = digest_push(file);
+        }
+        file->digest->done = 1;
+        file->digest = NULL;
+        digest_flush();
+    }
+}
+
+// frees a file tree mode is done with, or leaves that to the last of its hashed chunks
+void put_file(struct io_file_data* file) {
+    if (file->hash_jobs) {
+        file->dropped = 1;
+        return;
+    }
+    free(file->filename);
+    free(file);
+}
+
+// a hashed chunk counts towards its file, the digest is out when all of the file is in
+void hash_account(struct io_file_data* file, uint32_t crc, unsigned len) {
+    file->crc ^= crc;
+    file->hashed += len;
+    file->hash_jobs--;
+
+    if (file->hashed == file->filesize && file->digest) {
+        file->digest->crc = ~(crc32c_shift(~0u, file->filesize) ^ file->crc);
+        file->digest->done = 1;
+        file->digest = NULL;
+        digest_flush();
     }
 
-    fstat(fd, &st);
-    if (st.st_size < 1) {
+    if (file->dropped && file->hash_jobs == 0) {
+        free(file->filename);
+        free(file);
+    }
+}
+
+// takes back the buffers the workers are done with. with wait set it blocks until there is one,
+// time spent there is time the reads waited for the hashing
+void hash_reclaim(int wait) {
+    if (hash_outstanding == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&hq.lock);
+    if (wait && hq.done == NULL) {
+        double start = now_seconds();
+        while (hq.done == NULL) {
+            pthread_cond_wait(&hq.hashed, &hq.lock);
+        }
+        hash_starved += now_seconds() - start;
+    }
+    struct io_chunk* chunk = hq.done;
+    hq.done = NULL;
+    pthread_mutex_unlock(&hq.lock);
+
+    while (chunk) {
+        struct io_chunk* next = chunk->next;
+
+        hash_account(chunk->file, chunk->crc, chunk->len);
+        release_chunk(chunk);
+        hash_outstanding--;
+        chunk = next;
+    }
+}
+
+// every chunk handed out is hashed and accounted for
+void hash_drain() {
+    while (hash_outstanding) {
+        hash_reclaim(1);
+    }
+}
+
+// checksum consumer. keeps the buffer when a worker hashes it, hash_reclaim() gives it back
+int hash_chunk(struct io_file_data* file, off_t offset, const char* data, unsigned len) {
+    struct io_chunk* chunk = &chunk_pool[(data - chunk_pool[0].buffer) / chunk_size];
+
+    chunk->file = file;
+    chunk->offset = offset;
+    chunk->len = len;
+    chunk->trailing = file->filesize - offset - len;
+    file->hash_jobs++;
+
+    if (offset == 0 && print_digests && file->digest == NULL) {
+        file->digest = digest_push(file);
+    }
+
+    if (hash_workers == 0) {
+        double start = now_seconds();
+        hash_buffer(chunk, data);
+        hash_inline += now_seconds() - start;
+
+        hash_account(file, chunk->crc, len);
+        return 0;
+    }
+
+    pthread_mutex_lock(&hq.lock);
+    chunk->next = NULL;
+    if (hq.todo) {
+        hq.todo_tail->next = chunk;
+    } else {
+        hq.todo = chunk;
+    }
+    hq.todo_tail = chunk;
+    hq.pending++;
+    pthread_cond_signal(&hq.work);
+    pthread_mutex_unlock(&hq.lock);
+
+    hash_outstanding++;
+    return 1;
+}
+
+
+
+// opens files as the reader reaches them so only the ones being read hold an fd
+int open_file(struct io_file_data* file) {
+    struct stat st;
+
+    file->fd = open(file->filename, direct_io ? O_RDONLY | O_DIRECT : O_RDONLY);
+    if (file->fd < 0) {
+        fprintf(stderr,"file open error: %s \n", file->filename);
         return 1;
     }
 
+    fstat(file->fd, &st);
+    file->filesize = st.st_size;
+    file->next_offset = 0;
+    file->delivered = 0;
+    file->inflight = 0;
+    file->completed = NULL;
+    file->crc = 0;
+    file->hashed = 0;
+    file->digest = NULL;
+    return 0;
+}
 
-    //we'll be using only one iovec struct / buffer
-    fdata->filename = malloc(strlen(filename));
-    strcpy(fdata->filename, filename);
-    fdata->filesize = st.st_size;
-    fdata->iov->iov_len = st.st_size;
+// streams all files through at most depth concurrent reads, returns 0 when every byte was delivered
+int stream_files(struct io_file_data* files, int file_count, unsigned depth, chunk_consumer consumer) {
+    int next_file = 0;          // first file not opened yet
+    int current = -1;           // file ranges are taken from
+    int files_done = 0;
+
+    while (files_done < file_count) {
+        hash_reclaim(0);
+
+        // fill the queue, moving on to the next file as soon as the current one is fully queued
+        while (inflight < depth && free_chunks) {
+            if (current < 0 || files[current].next_offset >= files[current].filesize) {
+                if (next_file == file_count) {
+                    break;
+                }
+                current = next_file++;
+                if (open_file(&files[current])) {
+                    return 1;
+                }
+                if (print_digests) {
+                    files[current].digest = digest_push(&files[current]);
+                }
+                if (files[current].filesize == 0) {
+                    close(files[current].fd);
+                    hash_empty(&files[current]);
+                    files_done++;
+                    continue;
+                }
+            }
+            submit_chunk(&files[current]);
+        }
 
-    void* ptr;
-    ptr = malloc(st.st_size);
-    fdata->iov->iov_base = ptr;
+        if (files_done == file_count) {
+            break;
+        }
 
+        // every buffer is with the hash workers
+        if (inflight == 0) {
+            hash_reclaim(1);
+            continue;
+        }
 
-    unsigned tail, index;
+        //make the batch known to the kernel with one tail update, submit it and wait for at least one ready
+        to_submit += ring_flush(&ring);
+        enters++;
+        int res = sys_io_uring_enter(ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if(res < 0) {
+            perror("io_uring_enter error");
+            return 1;
+        }
+        to_submit -= res;
 
-    //
-    //add new submission to the tail
-    //
+        res = read_cqe(consumer);
+        if (res < 0) {
+            return 1;
+        }
+        files_done += res;
+    }
 
-    tail = *_sq.tail;
-    index = tail & *_sq.ring_mask;
-    struct io_uring_sqe *sqe = &_sqes[index];
+    return 0;
+}
 
-    sqe->fd = fd;
-    sqe->flags = 0;
-    sqe->opcode = IORING_OP_READV;
-    sqe->addr = (unsigned long) fdata->iov;
-    sqe->len = 1; //only one iov element
-    sqe->off = 0;
-    sqe->user_data = (unsigned long long) fdata;
-    _sq.array[index] = index;
-    tail++;
 
-    //tell the kernel new submission entry added
-    wmb();
-    *_sq.tail = tail;
-    wmb();
-    
 
+// small-file mode: statx -> openat -> read -> close as one linked chain per file. the file is opened
+// into a direct descriptor slot, so the chain never touches the fd table, and no syscall is made per file
+
+// the low bits of user_data tell the chain's CQEs apart
+#define SMALL_OP_STATX 0
+#define SMALL_OP_OPEN  1
+#define SMALL_OP_READ  2
+#define SMALL_OP_CLOSE 3
+#define SMALL_OP_MASK  3
+
+// one chain in flight, owns a direct descriptor slot and a pool buffer until its close completes
+struct io_small_read {
+    struct io_file_data* file;
+    struct io_chunk* chunk;
+    struct statx stx;
+    unsigned slot;
+    int bytes;                  // read result
+    int failed;
+    int done;                   // close completed, waiting for its turn with ordered output
+    unsigned long seq;          // submission order
+    struct io_small_read* next; // free list
+} __attribute__((aligned(8)));
+
+struct io_small_read* small_reads;      // arena, one entry per direct descriptor slot
+struct io_small_read* free_small_reads;
+unsigned small_read_count;
+
+// files that didn't fit in one chunk, streamed once the chains are done
+struct io_file_data* large_files;
+unsigned large_count;
+unsigned large_size;
+
+// ordered output: finished chains wait here until every earlier file was delivered. a chain holds
+// its entry until then, so at most small_read_count sequence numbers are ever outstanding
+int ordered_output;
+struct io_small_read** order_window;
+unsigned long submit_seq;
+unsigned long next_seq;
+
+// tree mode owns the files it reads, and skips the ones it can't read instead of stopping
+int tree_mode;
+unsigned long ingested_files;
+unsigned long ingested_bytes;
+unsigned long skipped_empty;
+unsigned long failed_files;
+
+// hands out the files to read in order, NULL when there is none right now. with wait set it
+// blocks until there is one, and NULL means there are no more
+typedef struct io_file_data* (*file_source)(int wait);
+
+
+// a sparse table of depth direct descriptors, kernel 5.19
+int init_small_reads(unsigned depth) {
+    struct io_uring_rsrc_register reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = depth;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+    if (sys_io_uring_register(ring.fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0) {
+        perror("registering a sparse file table failed, small-file mode needs kernel 5.19");
+        return 1;
+    }
+
+    small_reads = calloc(depth, sizeof(struct io_small_read));
+    order_window = calloc(depth, sizeof(struct io_small_read*));
+    small_read_count = depth;
+    free_small_reads = NULL;
+
+    for (unsigned i = 0; i < depth; i++) {
+        small_reads[i].slot = i;
+        small_reads[i].next = free_small_reads;
+        free_small_reads = &small_reads[i];
+    }
     return 0;
 }
 
+// queues the four linked SQEs of one file
+void submit_small_read(struct io_small_read* sr) {
+    struct io_uring_sqe* sqe;
+    unsigned long long user_data = (unsigned long long) sr;
+
+    sr->seq = submit_seq++;
+    if (ordered_output) {
+        order_window[sr->seq % small_read_count] = sr;
+    }
+
+    // successful statx and openat don't need a CQE, failures still post one
+    sqe = ring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long) sr->file->filename;
+    sqe->len = STATX_SIZE;
+    sqe->off = (unsigned long) &sr->stx;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = user_data | SMALL_OP_STATX;
+
+    sqe = ring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long) sr->file->filename;
+    sqe->open_flags = direct_io ? O_RDONLY | O_DIRECT : O_RDONLY;
+    sqe->file_index = sr->slot + 1;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = user_data | SMALL_OP_OPEN;
+
+    // files over the chunk size come back short and go to the streaming path
+    sqe = ring_get_sqe(&ring);
+    sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = sr->slot;
+    sqe->addr = (unsigned long) sr->chunk->buffer;
+    sqe->len = chunk_size;
+    sqe->off = 0;
+    sqe->buf_index = sr->chunk->index;
+    // hard link: the slot is closed even if the read failed
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->user_data = user_data | SMALL_OP_READ;
+
+    sqe = ring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = sr->slot + 1;
+    sqe->user_data = user_data | SMALL_OP_CLOSE;
+
+    inflight++;
+}
+
+int small_read_is_large(struct io_small_read* sr) {
+    return !sr->failed && sr->file->filesize > sr->bytes;
+}
+
+// delivers a finished chain, or queues its file for streaming when it didn't fit in one chunk.
+// gives the chain's entry and buffer back
+void finish_small_read(struct io_small_read* sr, chunk_consumer consumer) {
+    struct io_file_data* file = sr->file;
+    int large = small_read_is_large(sr);
+    int kept = 0;
+
+    if (large) {
+        if (large_count == large_size) {
+            large_size = large_size ? 2 * large_size : 64;
+            large_files = realloc(large_files, sizeof(struct io_file_data) * large_size);
+        }
+        // the copy is streamed, it keeps the name
+        large_files[large_count++] = *file;
+    }
+    else if (sr->bytes > 0) {
+        ingested_files++;
+        ingested_bytes += sr->bytes;
+        kept = consumer(file, 0, sr->chunk->buffer, sr->bytes);
+    }
+    else if (!sr->failed) {
+        skipped_empty++;
+        hash_empty(file);
+    }
+
+    if (!kept) {
+        release_chunk(sr->chunk);
+    }
+    sr->next = free_small_reads;
+    free_small_reads = sr;
+
+    if (tree_mode) {
+        if (large) {
+            free(file);
+        } else {
+            put_file(file);
+        }
+    }
+}
+
+// the finished chain at the head of the order, NULL while it's still in flight
+struct io_small_read* ordered_head() {
+    struct io_small_read* sr = order_window[next_seq % small_read_count];
+
+    return sr && sr->seq == next_seq && sr->done ? sr : NULL;
+}
+
+// delivers finished chains in submission order, stops at one still in flight or one too large
+// for its chunk. those are streamed by stream_ordered_head()
+void deliver_ordered(chunk_consumer consumer) {
+    struct io_small_read* sr;
+
+    while ((sr = ordered_head()) && !small_read_is_large(sr)) {
+        order_window[next_seq % small_read_count] = NULL;
+        next_seq++;
+        finish_small_read(sr, consumer);
+    }
+}
+
+// ordered output: a large file at the head of the order is streamed right away, which has to wait
+// until no chain is in flight since stream_files() reads the CQ on its own terms
+int stream_ordered_head(unsigned depth, chunk_consumer consumer) {
+    struct io_small_read* sr;
+
+    while ((sr = ordered_head()) && small_read_is_large(sr)) {
+        struct io_file_data* file = sr->file;
+
+        order_window[next_seq % small_read_count] = NULL;
+        next_seq++;
+        release_chunk(sr->chunk);
+        sr->next = free_small_reads;
+        free_small_reads = sr;
+
+        if (stream_files(file, 1, depth, consumer)) {
+            return 1;
+        }
+        ingested_files++;
+        ingested_bytes += file->filesize;
 
+        if (tree_mode) {
+            put_file(file);
+        }
+        deliver_ordered(consumer);
+    }
+    return 0;
+}
 
-int read_cqe() {
-    struct io_file_data* fdata;
+// returns 0, or -1 when a file failed outside of tree mode
+int read_small_cqe(chunk_consumer consumer) {
     struct io_uring_cqe* cqe;
-    unsigned head;
-    int entries_read = 0;
-    
-    head = *_cq.head;
+    unsigned head, tail;
+    int res = 0;
+
+    head = ring_cq_head(&ring);
+    tail = ring_cq_tail(&ring);
+
+    for (; head != tail; head++) {
+        cqe = ring_cqe_at(&ring, head);
+        struct io_small_read* sr = (struct io_small_read*) (cqe->user_data & ~(unsigned long long)SMALL_OP_MASK);
+        int op = cqe->user_data & SMALL_OP_MASK;
+
+        switch (op) {
+            case SMALL_OP_READ:
+                reads_completed++;
+                if (cqe->res < 0 && !sr->failed) {
+                    fprintf(stderr, "read error: %s, file %s\n", strerror(-cqe->res), sr->file->filename);
+                    sr->failed = 1;
+                }
+                sr->bytes = cqe->res;
+                break;
+
+            case SMALL_OP_STATX:
+            case SMALL_OP_OPEN:
+                fprintf(stderr, "%s error: %s, file %s\n", op == SMALL_OP_STATX ? "statx" : "openat", strerror(-cqe->res), sr->file->filename);
+                sr->failed = 1;
+                // a failed SQE with CQE_SKIP_SUCCESS takes the CQEs of the rest of its chain with it,
+                // the close never posts one. nothing was opened, the chain ends here
+                // fall through
+            case SMALL_OP_CLOSE:
+                inflight--;
+
+                if (sr->failed) {
+                    if (!tree_mode) {
+                        res = -1;
+                        break;
+                    }
+                    failed_files++;
+                }
+
+                sr->file->filesize = sr->stx.stx_size;
+
+                // the file grew after the statx. a read that stopped short of the chunk got all of it,
+                // a full one goes to streaming, which measures the file again
+                if (!sr->failed && sr->bytes > sr->file->filesize) {
+                    sr->file->filesize = (unsigned)sr->bytes < chunk_size ? sr->bytes : (off_t)chunk_size + 1;
+                }
+                sr->done = 1;
+
+                if (ordered_output) {
+                    deliver_ordered(consumer);
+                } else {
+                    finish_small_read(sr, consumer);
+                }
+                break;
+        }
+
+        if (res < 0) {
+            head++;
+            break;
+        }
+    }
+
+    ring_cq_advance(&ring, head);
+
+    return res;
+}
+
+// reads every file the source hands out with one chain each. files larger than a chunk are
+// streamed afterwards, or in their turn with ordered output
+int ingest_small_files(file_source source, unsigned depth, chunk_consumer consumer) {
+    int exhausted = 0;
+
+    large_count = 0;
+    submit_seq = next_seq = 0;
 
     while (1) {
-        rmb();
+        hash_reclaim(0);
 
-        if (head == *_cq.tail){
-            break;
+        if (ordered_output && inflight == 0 && stream_ordered_head(depth, consumer)) {
+            return 1;
         }
 
-        // read completed entry
-        cqe = &_cq.cqes[head & *_cq.ring_mask];
-        fdata = (struct io_file_data*) cqe->user_data;
-        printf("File: %s, readv res=%d\n", fdata->filename, cqe->res);
+        while (!exhausted && inflight < depth && free_small_reads && free_chunks) {
+            // with nothing in flight there is nothing else to wait for
+            int wait = inflight == 0;
+            struct io_file_data* file = source(wait);
+
+            if (file == NULL) {
+                exhausted = wait;
+                break;
+            }
+
+            struct io_small_read* sr = free_small_reads;
+            free_small_reads = sr->next;
+
+            sr->file = file;
+            file->crc = 0;
+            file->hashed = 0;
+            file->digest = NULL;
+            sr->chunk = free_chunks;
+            free_chunks = sr->chunk->next;
+            sr->bytes = 0;
+            sr->failed = 0;
+            sr->done = 0;
+
+            submit_small_read(sr);
+        }
 
-        if (cqe->res < 0) {
-            fprintf(stderr, "readv error: %s\n", strerror(cqe->res));
-        } 
+        if (inflight == 0) {
+            if (exhausted && (!ordered_output || next_seq == submit_seq)) {
+                break;
+            }
+            // every buffer is with the hash workers
+            if (free_chunks == NULL) {
+                hash_reclaim(1);
+            }
+            continue;
+        }
+
+        //make the batch known to the kernel with one tail update, submit it and wait for at least one ready
+        to_submit += ring_flush(&ring);
+        enters++;
+        int res = sys_io_uring_enter(ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if(res < 0) {
+            perror("io_uring_enter error");
+            return 1;
+        }
+        to_submit -= res;
+
+        if (read_small_cqe(consumer) < 0) {
+            return 1;
+        }
+    }
+
+    if (large_count) {
+        if (stream_files(large_files, large_count, depth, consumer)) {
+            return 1;
+        }
+        // the copies were streamed, sizes are already in the originals. their names go once hashed
+        hash_drain();
+        for (unsigned i = 0; i < large_count; i++) {
+            ingested_files++;
+            ingested_bytes += large_files[i].filesize;
+            if (tree_mode) {
+                free(large_files[i].filename);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+
+// argv files, in order
+struct io_file_data* arg_files;
+int arg_file_count;
+int arg_next;
+
+struct io_file_data* next_arg_file(int wait) {
+    return arg_next < arg_file_count ? &arg_files[arg_next++] : NULL;
+}
+
+
+
+// tree mode: a walker thread lists the files under the given roots into a bounded queue while the
+// ring reads them. the queue keeps the walk from running ahead of the reads with unbounded memory
+#define WALK_QUEUE_SIZE 4096
+
+struct walk_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct io_file_data* files[WALK_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+    int done;                   // nothing more will be queued
+    char** roots;
+    int root_count;
+    unsigned long dirs;
+    unsigned long full_waits;   // walker ahead, the reads set the pace
+    unsigned long empty_waits;  // ring idle waiting for the walk
+    struct timespec finished;   // when the walk was done
+};
+
+struct walk_queue walk = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
+
+// takes ownership of path
+void walk_push(char* path) {
+    struct io_file_data* file = calloc(1, sizeof(struct io_file_data));
+    file->filename = path;
+
+    pthread_mutex_lock(&walk.lock);
+    if (walk.tail - walk.head == WALK_QUEUE_SIZE) {
+        walk.full_waits++;
+    }
+    while (walk.tail - walk.head == WALK_QUEUE_SIZE) {
+        pthread_cond_wait(&walk.not_full, &walk.lock);
+    }
+    walk.files[walk.tail++ % WALK_QUEUE_SIZE] = file;
+    pthread_cond_signal(&walk.not_empty);
+    pthread_mutex_unlock(&walk.lock);
+}
+
+// regular files are queued, directories walked, anything else is skipped
+void walk_path(char* path, unsigned char type) {
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+
+        if (lstat(path, &st) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+    }
+
+    if (type == DT_REG) {
+        walk_push(path);
+        return;
+    }
+
+    if (type == DT_DIR) {
+        DIR* dir = opendir(path);
+        struct dirent* entry;
+
+        if (dir == NULL) {
+            fprintf(stderr, "can't open directory %s: %s\n", path, strerror(errno));
+        }
         else {
-        
-           //print out last 10 chars or less 
-           char* buff = (char*)fdata->iov->iov_base;
-           if (cqe->res > 10) {
-  	       printf("%.10s", &buff[cqe->res-10]);   
-           } else {
-               printf("%.*s", cqe->res, buff);
-           } 
-           //
+            walk.dirs++;
+            while ((entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                    continue;
+                }
+
+                char* child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+                sprintf(child, "%s/%s", path, entry->d_name);
+                walk_path(child, entry->d_type);
+            }
+            closedir(dir);
+        }
+    }
+    free(path);
+}
+
+void* walk_tree(void* arg) {
+    for (int i = 0; i < walk.root_count; i++) {
+        walk_path(strdup(walk.roots[i]), DT_UNKNOWN);
+    }
+
+    pthread_mutex_lock(&walk.lock);
+    clock_gettime(CLOCK_MONOTONIC, &walk.finished);
+    walk.done = 1;
+    pthread_cond_signal(&walk.not_empty);
+    pthread_mutex_unlock(&walk.lock);
+    return NULL;
+}
+
+struct io_file_data* next_walked_file(int wait) {
+    struct io_file_data* file = NULL;
+
+    pthread_mutex_lock(&walk.lock);
+    if (wait && walk.head == walk.tail && !walk.done) {
+        walk.empty_waits++;
+    }
+    while (wait && walk.head == walk.tail && !walk.done) {
+        pthread_cond_wait(&walk.not_empty, &walk.lock);
+    }
+    if (walk.head != walk.tail) {
+        file = walk.files[walk.head++ % WALK_QUEUE_SIZE];
+        // a walker blocked on a full queue resumes at half, not for every single slot
+        if (walk.tail - walk.head == WALK_QUEUE_SIZE / 2) {
+            pthread_cond_signal(&walk.not_full);
         }
-        entries_read++;
-        head++;
+    }
+    pthread_mutex_unlock(&walk.lock);
+    return file;
+}
+
+// walks the trees and reads every regular file in them, the walk runs alongside the reads
+int ingest_tree(char** roots, int root_count, unsigned depth, chunk_consumer consumer) {
+    pthread_t walker;
+
+    walk.roots = roots;
+    walk.root_count = root_count;
+    walk.head = walk.tail = 0;
+    walk.done = 0;
+    walk.dirs = 0;
+    walk.full_waits = walk.empty_waits = 0;
+
+    if (pthread_create(&walker, NULL, walk_tree, NULL)) {
+        perror("starting the walker thread failed \n");
+        return 1;
     }
 
-    *_cq.head = head;
-    wmb();
+    int res = ingest_small_files(next_walked_file, depth, consumer);
 
-    return entries_read;
+    // on an error the walker may be blocked on a full queue, nothing is waiting for it
+    if (res == 0) {
+        pthread_join(walker, NULL);
+    }
+    return res;
+}
+
+
+
+// user + system CPU of the process, includes the kernel polling for IOPOLL completions
+double cpu_seconds() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
 }
 
 
 
 int main(int argc, char *argv[]) {
 
-    if (argc < 2) {
+    unsigned depths[MAX_DEPTHS] = { QUEUE_DEPTH };
+    int depth_count = 1;
+    unsigned buffers = 0;
+    int quiet = 0;
+    int small_files = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "c:q:b:dBpsrok:Qh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c':
+                chunk_size = strtol(optarg, NULL, 10) * 1024;
+                if (chunk_size == 0) {
+                    fprintf(stderr, "Chunk size must be > 0 KiB\n");
+                    return 1;
+                }
+                break;
+            case 'q': {
+                char* arg = optarg;
+                depth_count = 0;
+                while (*arg && depth_count < MAX_DEPTHS) {
+                    depths[depth_count] = strtol(arg, &arg, 10);
+                    if (depths[depth_count] < 1 || depths[depth_count] > URING_QUEUE_SIZE) {
+                        fprintf(stderr, "Queue depth must be > 0 and <= %i\n", URING_QUEUE_SIZE);
+                        return 1;
+                    }
+                    depth_count++;
+                    if (*arg == ',') {
+                        arg++;
+                    }
+                }
+                break;
+            }
+            case 'b':
+                buffers = strtol(optarg, NULL, 10);
+                break;
+            case 'd':
+                direct_io = 1;
+                fixed_buffers = 1;
+                break;
+            case 'B':
+                fixed_buffers = 1;
+                break;
+            case 'p':
+                polled_io = 1;
+                break;
+            case 's':
+                small_files = 1;
+                break;
+            case 'r':
+                tree_mode = 1;
+                small_files = 1;
+                break;
+            case 'o':
+                ordered_output = 1;
+                break;
+            case 'k':
+                checksum = 1;
+                hash_workers = strtol(optarg, NULL, 10);
+                if (hash_workers > 64) {
+                    fprintf(stderr, "Hash workers must be <= 64\n");
+                    return 1;
+                }
+                break;
+            case 'Q':
+                quiet = 1;
+                break;
+            case 'h':
+                printf("usage: %s [options] file...\n", argv[0]);
+                printf("      -c: chunk size in KiB, each file is read in ranges of this size. defaults to %i \n", CHUNK_SIZE_KB);
+                printf("      -q: reads in flight across files, defaults to %i. a list like 1,4,16 runs once per depth \n", QUEUE_DEPTH);
+                printf("      -b: buffer pool size in chunks, bounds memory use. defaults to twice the largest depth \n");
+                printf("      -d: bypass the page cache, O_DIRECT reads with READ_FIXED into a registered buffer pool \n");
+                printf("      -B: buffered reads with READ_FIXED into the registered pool \n");
+                printf("      -p: with -d, IOPOLL ring: completions are polled from the device instead of interrupts \n");
+                printf("      -s: small files: statx, open, read and close each file with one linked chain on direct descriptors. \n");
+                printf("          files larger than a chunk are streamed afterwards \n");
+                printf("      -r: the arguments are directory trees. a walker thread lists them while their files are read \n");
+                printf("          with -s chains. directories, empty and unreadable files are skipped \n");
+                printf("      -o: with -s or -r, files are delivered whole and in order, large ones are streamed in their turn \n");
+                printf("      -k: CRC32C of every file, hashed on this many threads while the next reads are in flight. \n");
+                printf("          0 hashes on the ring thread after each read. prints a digest per file, -Q only the totals \n");
+                printf("      -Q: don't print file tails, only throughput \n");
+                return 0;
+        }
+    }
+
+    if (optind >= argc) {
         fprintf(stderr, "No files provided\n");
         return 1;
     }
 
-    memset(&_sq, 0, sizeof(_sq));
-    memset(&_cq, 0, sizeof(_cq));
-    
-    if(init_uring()) {
+    if (ordered_output && !small_files) {
+        fprintf(stderr, "Ordered output (-o) needs small-file chains (-s) or tree mode (-r)\n");
+        return 1;
+    }
+
+    if (polled_io && !direct_io) {
+        fprintf(stderr, "Polled completions (-p) only work with O_DIRECT (-d)\n");
+        return 1;
+    }
+
+    // IOPOLL rings only take reads and writes
+    if (polled_io && small_files) {
+        fprintf(stderr, "Polled completions (-p) can't be used in small-file or tree mode (-s, -r)\n");
+        return 1;
+    }
+
+    if (direct_io && chunk_size % DIRECT_ALIGN) {
+        fprintf(stderr, "O_DIRECT chunks must be a multiple of %i bytes\n", DIRECT_ALIGN);
+        return 1;
+    }
+
+    if(init_uring(polled_io ? IORING_SETUP_IOPOLL : 0)) {
         fprintf(stderr, "io_uring_setup error\n");
         return 1;
     }
 
-    int file_count = argc - 1;
-    printf("Files to process: %i\n", file_count);
+    unsigned max_depth = 0;
+    for (int i = 0; i < depth_count; i++) {
+        max_depth = depths[i] > max_depth ? depths[i] : max_depth;
+    }
+
+    // spare buffers let later chunks complete while an earlier one of the same file is still in flight
+    if (buffers == 0) {
+        buffers = 2 * max_depth;
+    }
 
-    //loop through files and add to SQE
-    for (int i = 1; i <= file_count; i++) {
-        if(submit_sqe(argv[i])) {
-            fprintf(stderr, "Error reading file %s\n", argv[i]);
+    if (init_pool(buffers)) {
+        return 1;
+    }
+
+    if (checksum) {
+        crc32c_init();
+        print_digests = !quiet;
+        if (start_hash_workers()) {
             return 1;
         }
     }
 
-    //make changes known to kernel. Submit all file readv SQEs and wait for at least one ready
-    int res = io_uring_enter(uring_fd, file_count, 1, IORING_ENTER_GETEVENTS);
-    if(res < 0) {
-        perror("submit: io_uring_enter error");
+    if (fixed_buffers && register_pool()) {
         return 1;
     }
-    
 
-    int entires_read = 0;
-    //read results from CQE as they come
-    while(1) {
-       entires_read += read_cqe(); 
-       printf("--- entries read: %i\n", entires_read);
+    if (small_files) {
+        if (max_depth > URING_QUEUE_SIZE / SMALL_CHAIN_LEN) {
+            fprintf(stderr, "Small-file mode takes up to %i files in flight\n", URING_QUEUE_SIZE / SMALL_CHAIN_LEN);
+            return 1;
+        }
+        if (init_small_reads(max_depth)) {
+            return 1;
+        }
+    }
+
+    int file_count = argc - optind;
+    struct io_file_data* files = calloc(file_count, sizeof(struct io_file_data));
 
-       if (entires_read < file_count) {
-          res = io_uring_enter(uring_fd, 0, 1, IORING_ENTER_GETEVENTS);
-          if(res < 0) {
-             perror("read: io_uring_enter error");
-             return 1;
-          }          
-       }
-       else {
-          break;
-       }
+    for (int i = 0; i < file_count; i++) {
+        files[i].filename = argv[optind + i];
     }
 
-    printf("\n...done\n");
+    printf("%s to process: %i, %u KiB chunks, %u buffers, %s%s%s%s%s\n", tree_mode ? "Trees" : "Files", file_count, chunk_size / 1024, buffers,
+           direct_io ? "O_DIRECT with registered buffers" : fixed_buffers ? "buffered, registered buffers" : "buffered", polled_io ? ", polled completions" : "",
+           small_files ? ", linked small-file chains" : "", ordered_output ? ", ordered output" : "",
+           checksum ? ", CRC32C" : "");
 
-    return 0;
-}
+    for (int i = 0; i < depth_count; i++) {
+        struct timespec start, end;
+        double cpu_start = cpu_seconds();
 
+        reads_completed = 0;
+        enters = 0;
+        ingested_files = ingested_bytes = skipped_empty = failed_files = 0;
+        hash_starved = hash_inline = 0;
+        double hash_cpu_start = hash_worker_seconds();
+        clock_gettime(CLOCK_MONOTONIC, &start);
 
+        chunk_consumer consumer = checksum ? hash_chunk : quiet ? discard_chunk : print_tail;
+        int res;
 
+        if (tree_mode) {
+            res = ingest_tree(&argv[optind], file_count, depths[i], consumer);
+        }
+        else if (small_files) {
+            arg_files = files;
+            arg_file_count = file_count;
+            arg_next = 0;
+            res = ingest_small_files(next_arg_file, depths[i], consumer);
+        }
+        else {
+            res = stream_files(files, file_count, depths[i], consumer);
+        }
+        if (res) {
+            fprintf(stderr, "Error reading files\n");
+            return 1;
+        }
+
+        // the last chunks may still be hashing, that is part of the run
+        double reads_end = now_seconds();
+        hash_drain();
+        double hash_tail = now_seconds() - reads_end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        unsigned long total = 0;
+        unsigned long files_read = file_count;
+        for (int f = 0; f < file_count && !tree_mode; f++) {
+            total += files[f].filesize;
+        }
+
+        if (tree_mode) {
+            total = ingested_bytes;
+            files_read = ingested_files;
+        }
+
+        double cpu = cpu_seconds() - cpu_start;
+
+        printf("--- depth %u: %lu bytes in %.3f s, %.1f MB/s, %.0f files/s, %.0f IOPS, %.2f cpu s/GB, %lu enters\n", depths[i], total, elapsed,
+               total / elapsed / 1e6, files_read / elapsed, reads_completed / elapsed, total ? cpu / (total / 1e9) : 0.0, enters);
+
+        // a walker waiting on a full queue means the reads set the pace, a ring waiting on an empty one the walk
+        if (tree_mode) {
+            double walked = (walk.finished.tv_sec - start.tv_sec) + (walk.finished.tv_nsec - start.tv_nsec) / 1e9;
+            printf("--- %lu files in %lu directories, %lu empty and %lu unreadable skipped\n", files_read, walk.dirs, skipped_empty, failed_files);
+            printf("--- walk done after %.3f s, walker waited %lu times on a full queue, ring %lu times on an empty one\n",
+                   walked, walk.full_waits, walk.empty_waits);
+        }
+
+        // reads waiting for buffers that are still being hashed means the hashing sets the pace
+        if (checksum && hash_workers) {
+            double hashing = hash_worker_seconds() - hash_cpu_start;
+            printf("--- crc32c %s on %u worker%s: %.3f s cpu, %.1f GB/s per core. reads waited %.3f s for hashed buffers, %.3f s for the last ones: %s bound\n",
+                   crc32c_impl(), hash_workers, hash_workers > 1 ? "s" : "", hashing, hashing > 0 ? total / hashing / 1e9 : 0.0,
+                   hash_starved > hash_tail ? hash_starved - hash_tail : 0.0, hash_tail,
+                   hash_starved > 0.1 * elapsed ? "hashing" : "I/O");
+        }
+        else if (checksum) {
+            printf("--- crc32c %s on the ring thread: %.3f s of %.3f s, %.1f GB/s: %s bound\n", crc32c_impl(), hash_inline, elapsed,
+                   hash_inline > 0 ? total / hash_inline / 1e9 : 0.0, hash_inline > elapsed / 2 ? "hashing" : "I/O");
+        }
+    }
+
+    ring_exit(&ring);
+    printf("\n...done\n");
+
+    return 0;
+}
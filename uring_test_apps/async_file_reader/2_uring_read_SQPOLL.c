@@ -3,319 +3,380 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <dirent.h>
 
 #include <sys/stat.h>
-#include <sys/syscall.h>
-#include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/resource.h>
 
-#include <linux/io_uring.h> //kernel 5.1 required
-
-#define __NR_io_uring_setup 425
-#define __NR_io_uring_enter 426
-#define __NR_io_uring_register 427
+#include "raw_ring.h"
 
 #define URING_QUEUE_SIZE  1024
 
-#define rmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
-#define wmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
+#define QUEUE_DEPTH 32          // default whole-file reads in flight
+#define SQ_IDLE_MSEC 1000       // default time the poller spins on an empty SQ before it sleeps
 
 struct io_file_data {
     char* filename;
+    int index;              // slot in the registered file table
     off_t filesize;
-    struct iovec* iov;      
+    off_t done;             // bytes read so far, short reads are resubmitted for the rest
+    char* buffer;           // the whole file
+    struct iovec* iov;
 };
 
 
-struct app_sq_ring {
-    unsigned* head;
-    unsigned* tail;
-    unsigned* ring_mask;
-    unsigned* ring_entries;
-    unsigned* flags;
-    unsigned* array;
-};
-
-struct app_cq_ring {
-    unsigned* head;
-    unsigned* tail;
-    unsigned* ring_mask;
-    unsigned* ring_entries;
-    struct io_uring_cqe* cqes;
-};
+//global app reference to uring interface
+struct raw_ring ring;
 
-
-//global app references to uring interface
-int uring_fd;
-struct app_sq_ring _sq;
-struct app_cq_ring _cq;
-struct io_uring_sqe* _sqes;
-
-
-// these are not in the linux c library yet
-int io_uring_setup(unsigned entries, struct io_uring_params *p)
-{
-    return (int) syscall(__NR_io_uring_setup, entries, p);
-}
-
-int io_uring_enter(int ring_fd, unsigned int to_submit,unsigned int min_complete, unsigned int flags)
-{
-    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
-}
-
-int io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args) {
-    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
-}
+//submission side syscalls, the point of SQPOLL is to need few of them
+unsigned long wakeups;          // poller found asleep after a tail publish
+unsigned long waits;            // io_uring_enter to wait for completions
+unsigned long tail_publishes;
+unsigned inflight;
+int spin_wait;                  // reap by spinning on the CQ tail, no syscall at all
 
 
 //  init uring interface
-int init_uring() {
+int init_uring(unsigned idle_msec, int sq_cpu) {
     struct io_uring_params p;
     memset(&p, 0, sizeof(p));
 
-    //setup for IORING_SETUP_SQPOLL
+    //setup for IORING_SETUP_SQPOLL, the kernel thread submits whatever shows up in the SQ
     p.flags = IORING_SETUP_SQPOLL;
-    p.sq_thread_idle = 99999999;
-
-    uring_fd = io_uring_setup(URING_QUEUE_SIZE, &p); 
-    if (uring_fd < 0) {
-        perror("io_uring_setup failed");
-        return 1;
-    }
+    p.sq_thread_idle = idle_msec;
 
-    void* ptr;
-
-    //mapping submission queue 
-    ptr = mmap(0, p.sq_off.array + p.sq_entries * sizeof(__u32), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed for submission queue");
-        return 1;
+    if (sq_cpu >= 0) {
+        p.flags |= IORING_SETUP_SQ_AFF;
+        p.sq_thread_cpu = sq_cpu;
     }
 
-    //save for easier reference
-    _sq.head = ptr + p.sq_off.head;
-    _sq.tail = ptr + p.sq_off.tail;
-    _sq.ring_mask = ptr + p.sq_off.ring_mask;
-    _sq.ring_entries = ptr + p.sq_off.ring_entries;
-    _sq.flags = ptr + p.sq_off.flags;
-    _sq.array = ptr + p.sq_off.array;
-
-
-    //mapping submission queue entries
-    _sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_SQES);
-    if (_sqes == MAP_FAILED) {
-        perror("mmap failed for submission queue entries");
+    int res = ring_init(&ring, URING_QUEUE_SIZE, &p);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-res));
         return 1;
     }
-
-
-    //mapping completion queue 
-    ptr = mmap(0, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring_fd, IORING_OFF_CQ_RING);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed for completion queue");
-        return 1;
-    }
-
-    //save for easier reference
-    _cq.head = ptr + p.cq_off.head;
-    _cq.tail = ptr + p.cq_off.tail;
-    _cq.ring_mask = ptr + p.cq_off.ring_mask;
-    _cq.ring_entries = ptr + p.cq_off.ring_entries;
-    _cq.cqes = ptr + p.cq_off.cqes;
-
     return 0;
 }
 
-
-
-
-int submit_sqe(int fd, char* filename) {
-    struct stat st;
-    struct io_file_data* fdata;
-
-    fdata = malloc(sizeof(struct io_file_data));
-    fdata->iov = malloc(sizeof(struct iovec));
-
-    fstat(fd, &st);
-    if (st.st_size < 1) {
-        return 1;
+// publishes everything queued since the last call. a poller that went idle sleeps until woken,
+// so the flag is checked after every publish, not once up front
+void ur_submit() {
+    if (ring_flush(&ring) == 0) {
+        return;
     }
+    tail_publishes++;
 
-    //we'll be using only one iovec struct / buffer
-    fdata->filename = malloc(strlen(filename));
-    strcpy(fdata->filename, filename);
-    fdata->filesize = st.st_size;
-    fdata->iov->iov_len = st.st_size;
+    if (ring_sq_needs_wakeup(&ring)) {
+        wakeups++;
+        sys_io_uring_enter(ring.fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }
+}
 
-    void* ptr;
-    ptr = malloc(st.st_size);
-    fdata->iov->iov_base = ptr;
 
 
-    unsigned tail, index;
+void queue_read(struct io_file_data* fdata) {
+    fdata->iov->iov_base = fdata->buffer + fdata->done;
+    fdata->iov->iov_len = fdata->filesize - fdata->done;
 
-    //
-    //add new submission to the tail
-    //
+    //added to the SQ, the poller sees it after ur_submit()
+    struct io_uring_sqe *sqe = ring_get_sqe(&ring);
 
-    tail = *_sq.tail;
-    index = tail & *_sq.ring_mask;
-    struct io_uring_sqe *sqe = &_sqes[index];
-   
     //because of IORING_SETUP_SQPOLL
-    sqe->fd = 0; 
+    sqe->fd = fdata->index;
     sqe->flags = IOSQE_FIXED_FILE;
     //
     sqe->opcode = IORING_OP_READV;
     sqe->addr = (unsigned long) fdata->iov;
     sqe->len = 1; //only one iov element
-    sqe->off = 0;
+    sqe->off = fdata->done;
     sqe->user_data = (unsigned long long) fdata;
-    _sq.array[index] = index;
-    tail++;
 
-    //tell the kernel new submission entry added
-    wmb();
-    *_sq.tail = tail;
-    wmb();
-    
+    inflight++;
+}
 
+int submit_sqe(struct io_file_data* fdata) {
+    //we'll be using only one iovec struct / buffer, big enough for the whole file
+    fdata->iov = malloc(sizeof(struct iovec));
+    fdata->buffer = malloc(fdata->filesize);
+    fdata->done = 0;
+
+    if (fdata->buffer == NULL) {
+        fprintf(stderr, "no memory for %s, %li bytes\n", fdata->filename, (long)fdata->filesize);
+        return 1;
+    }
+
+    queue_read(fdata);
     return 0;
 }
 
+void complete_file(struct io_file_data* fdata, int quiet) {
+    if (!quiet) {
+        //print out last 10 chars or less
+        char* buff = fdata->buffer;
+        printf("File: %s, %li bytes\n", fdata->filename, (long)fdata->filesize);
+        if (fdata->filesize > 10) {
+            printf("%.10s\n", &buff[fdata->filesize-10]);
+        } else {
+            printf("%.*s\n", (int)fdata->filesize, buff);
+        }
+    }
+
+    free(fdata->buffer);
+    free(fdata->iov);
+}
+
 
 
-int read_cqe() {
+// returns the number of files finished, -1 on a read error
+int read_cqe(int quiet) {
     struct io_file_data* fdata;
     struct io_uring_cqe* cqe;
-    unsigned head;
-    int entries_read = 0;
-    
-    head = *_cq.head;
+    unsigned head, tail;
+    int files_done = 0;
 
-    while (1) {
-        rmb();
+    head = ring_cq_head(&ring);
+    tail = ring_cq_tail(&ring);
+
+    for (; head != tail; head++) {
+        // read completed entry
+        cqe = ring_cqe_at(&ring, head);
+        fdata = (struct io_file_data*) cqe->user_data;
+        inflight--;
 
-        if (head == *_cq.tail){
+        if (cqe->res <= 0) {
+            fprintf(stderr, "readv error: %s, file %s\n", cqe->res ? strerror(-cqe->res) : "file shrank", fdata->filename);
+            files_done = -1;
+            head++;
             break;
         }
 
-        // read completed entry
-        cqe = &_cq.cqes[head & *_cq.ring_mask];
-        fdata = (struct io_file_data*) cqe->user_data;
-        printf("File: %s, readv res=%d\n", fdata->filename, cqe->res);
-
-        if (cqe->res < 0) {
-            fprintf(stderr, "readv error: %s\n", strerror(cqe->res));
-        } 
-        else {
-        
-           //print out last 10 chars or less 
-           char* buff = (char*)fdata->iov->iov_base;
-           if (cqe->res > 10) {
-  	       printf("%.10s", &buff[cqe->res-10]);   
-           } else {
-               printf("%.*s", cqe->res, buff);
-           } 
-           //
+        fdata->done += cqe->res;
+        if (fdata->done < fdata->filesize) {
+            // short read, the rest goes back in
+            queue_read(fdata);
+            continue;
         }
-        entries_read++;
-        head++;
+
+        complete_file(fdata, quiet);
+        files_done++;
     }
 
-    *_cq.head = head;
-    wmb();
+    // one head update for the whole drain
+    ring_cq_advance(&ring, head);
 
-    return entries_read;
+    return files_done;
 }
 
-int ur_needs_waking() {
-   wmb();
-   if (*_sq.flags & IORING_SQ_NEED_WAKEUP) {
-      printf("waking up..\n");
-      io_uring_enter(uring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
-   }
-   else {
-      printf("not sleeping..\n");
-   }
+// blocks until a completion is there, in the kernel or by spinning on the CQ tail
+int wait_cqe() {
+    if (spin_wait) {
+        while (ring_cq_head(&ring) == ring_cq_tail(&ring)) {
+            cpu_relax();
+        }
+        return 0;
+    }
+
+    waits++;
+    int res = sys_io_uring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS);
+    if(res < 0) {
+        perror("read: io_uring_enter error");
+        return 1;
+    }
+    return 0;
 }
 
 
 
+// user + system CPU of the process, includes the poller thread
+double cpu_seconds() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// CPU used by the poller alone, it's the "iou-sqp-<pid>" thread of this process
+double poller_cpu_seconds() {
+    DIR* tasks = opendir("/proc/self/task");
+    struct dirent* task;
+    double cpu = 0;
+
+    if (tasks == NULL) {
+        return 0;
+    }
+
+    while ((task = readdir(tasks)) != NULL) {
+        char path[300], stat[512];
+        unsigned long utime, stime;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", task->d_name);
+        FILE* f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+
+        // pid (comm) state ppid ... utime and stime are fields 14 and 15
+        if (fgets(stat, sizeof(stat), f) && strstr(stat, "(iou-sqp-")) {
+            char* fields = strrchr(stat, ')') + 2;
+            if (sscanf(fields, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+                cpu += (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+            }
+        }
+        fclose(f);
+    }
+
+    closedir(tasks);
+    return cpu;
+}
+
 
 
 int main(int argc, char *argv[]) {
 
     int* filefds;
+    unsigned depth = QUEUE_DEPTH;
+    unsigned idle_msec = SQ_IDLE_MSEC;
+    int sq_cpu = -1;
+    int quiet = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "q:i:a:sQh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'q':
+                depth = strtol(optarg, NULL, 10);
+                if (depth < 1 || depth > URING_QUEUE_SIZE) {
+                    fprintf(stderr, "Queue depth must be > 0 and <= %i\n", URING_QUEUE_SIZE);
+                    return 1;
+                }
+                break;
+            case 'i':
+                idle_msec = strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                sq_cpu = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                spin_wait = 1;
+                break;
+            case 'Q':
+                quiet = 1;
+                break;
+            case 'h':
+                printf("usage: %s [options] file...\n", argv[0]);
+                printf("      -q: whole-file reads in flight, defaults to %i \n", QUEUE_DEPTH);
+                printf("      -i: poller idle time in msec before it sleeps and needs a wakeup, defaults to %i \n", SQ_IDLE_MSEC);
+                printf("      -a: pin the poller thread to this CPU (IORING_SETUP_SQ_AFF). default is unpinned \n");
+                printf("      -s: wait for completions by spinning on the CQ instead of io_uring_enter. needs a CPU besides the poller's \n");
+                printf("      -Q: don't print file tails, only throughput \n");
+                return 0;
+        }
+    }
 
-    if (argc < 2) {
+    if (optind >= argc) {
         fprintf(stderr, "No files provided\n");
         return 1;
     }
 
-    memset(&_sq, 0, sizeof(_sq));
-    memset(&_cq, 0, sizeof(_cq));
-    
-    if(init_uring()) {
+    if(init_uring(idle_msec, sq_cpu)) {
         fprintf(stderr, "io_uring_setup error\n");
         return 1;
     }
 
-    int file_count = argc - 1;
-    printf("Files to process: %i\n", file_count);
+    int file_count = argc - optind;
+    struct io_file_data* files = calloc(file_count, sizeof(struct io_file_data));
+
+    printf("Files to process: %i, depth %u, poller idle %u ms, %s, %s\n", file_count, depth, idle_msec,
+           sq_cpu >= 0 ? "poller pinned" : "poller unpinned", spin_wait ? "spinning on the CQ" : "waiting in io_uring_enter");
 
 
     //init fds storage
     filefds = malloc(sizeof(int)*file_count);
 
-    for (int i = 1; i <= file_count; i++) {
-       filefds[i-1] = open(argv[i], O_RDONLY);
-       if (filefds[i-1] < 0) {
-           fprintf(stderr,"file open error: %s \n", argv[i]);
+    for (int i = 0; i < file_count; i++) {
+       struct stat st;
+
+       files[i].filename = argv[optind + i];
+       files[i].index = i;
+
+       filefds[i] = open(files[i].filename, O_RDONLY);
+       if (filefds[i] < 0) {
+           fprintf(stderr,"file open error: %s \n", files[i].filename);
            return 1;
        }
+
+       fstat(filefds[i], &st);
+       files[i].filesize = st.st_size;
     }
 
     //register all fds with uring
-    int r = io_uring_register(uring_fd, IORING_REGISTER_FILES, filefds, file_count);
+    int r = sys_io_uring_register(ring.fd, IORING_REGISTER_FILES, filefds, file_count);
     if (r < 0) {
         perror("io_uring_register_failed...\n");
         exit(1);
     }
 
-    ur_needs_waking();
 
-    //loop through files and add to SQE
-    for (int i = 1; i <= file_count; i++) {
-        if(submit_sqe(filefds[i-1], argv[i])) {
-            fprintf(stderr, "Error reading file %s\n", argv[i]);
+    struct timespec start, end;
+    double cpu_start = cpu_seconds();
+    double poller_start = poller_cpu_seconds();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int next_file = 0;
+    int files_done = 0;
+
+    //keep depth files in flight, refilling as completions come in
+    while (files_done < file_count) {
+        while (inflight < depth && next_file < file_count) {
+            struct io_file_data* fdata = &files[next_file++];
+
+            if (fdata->filesize == 0) {
+                files_done++;
+                continue;
+            }
+            if (submit_sqe(fdata)) {
+                return 1;
+            }
+        }
+
+        ur_submit();
+
+        if (files_done == file_count) {
+            break;
+        }
+
+        if (ring_cq_head(&ring) == ring_cq_tail(&ring) && wait_cqe()) {
             return 1;
         }
+
+        int res = read_cqe(quiet);
+        if (res < 0) {
+            fprintf(stderr, "Error reading files\n");
+            return 1;
+        }
+        files_done += res;
     }
-   
-
-    int res = 0; 
-    int entires_read = 0;
-    //read results from CQE as they come
-    while(1) {
-       if (entires_read < file_count) {
-          res = io_uring_enter(uring_fd, 0, 1, IORING_ENTER_GETEVENTS);
-          if(res < 0) {
-             perror("read: io_uring_enter error");
-             return 1;
-          }
-          entires_read += read_cqe();
-          printf("--- entries read: %i\n", entires_read);          
-       }
-       else {
-          break;
-       }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    unsigned long total = 0;
+    for (int f = 0; f < file_count; f++) {
+        total += files[f].filesize;
     }
 
+    double cpu = cpu_seconds() - cpu_start;
+    double poller_cpu = poller_cpu_seconds() - poller_start;
+
+    printf("--- depth %u: %lu bytes in %.3f s, %.1f MB/s, %.0f files/s, %.2f cpu s/GB (poller %.3f s of %.3f s)\n", depth, total, elapsed,
+           total / elapsed / 1e6, file_count / elapsed, total ? cpu / (total / 1e9) : 0.0, poller_cpu, cpu);
+    printf("--- %lu enters: %lu poller wakeups, %lu waits; %lu tail publishes\n", wakeups + waits, wakeups, waits, tail_publishes);
+
+    ring_exit(&ring);
     printf("\n...done\n");
 
     return 0;
 }
-
-
-
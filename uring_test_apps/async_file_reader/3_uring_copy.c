@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "raw_ring.h"
+
+#define URING_QUEUE_SIZE  1024
+
+#define BLOCK_SIZE_KB 128       // default read->write pair size
+#define QUEUE_DEPTH 64          // default blocks in flight, also the most files open at once
+#define MAX_DEPTH (URING_QUEUE_SIZE / 8)
+#define DIRECT_ALIGN 4096       // O_DIRECT offsets, lengths and buffers are multiples of this
+
+// copy engine: every file is copied on two direct descriptors, with the data going through a registered
+// buffer pool in linked read->write pairs. a file that fits in one block is copied by a single chain,
+// openat -> openat -> read -> write -> close -> close. larger ones are opened and preallocated by one
+// chain, copied by as many pairs as there are buffers, then closed by another chain
+
+// the low bits of user_data tell the SQEs of a chain apart
+#define COPY_OP_OPEN_SRC  0
+#define COPY_OP_OPEN_DST  1
+#define COPY_OP_FALLOCATE 2
+#define COPY_OP_READ      3
+#define COPY_OP_WRITE     4
+#define COPY_OP_CLOSE_SRC 5
+#define COPY_OP_CLOSE     6
+#define COPY_OP_MASK      7
+
+struct copy_block;
+
+struct copy_file {
+    char* src;
+    char* dst;
+    off_t size;
+    mode_t mode;
+    unsigned slot;              // source in direct descriptor 2 * slot, destination in the one after
+    int single;                 // one chain does it all
+    int preallocate;            // the open chain ends with a fallocate
+    off_t next_offset;          // start of the next block to copy
+    off_t copied;
+    unsigned inflight;          // pairs
+    int failed;
+    struct copy_block* block;   // single chain
+    struct copy_file* next;     // ready list
+} __attribute__((aligned(8)));
+
+// one read->write pair, owns a registered buffer while in flight
+struct copy_block {
+    struct copy_file* file;
+    off_t offset;
+    unsigned len;
+    unsigned done;              // bytes written so far, short reads and writes are resubmitted for the rest
+    int read_res;               // reads only post a CQE when they fail or come up short
+    int tail;                   // O_DIRECT: the unaligned end of a file, read and written unlinked
+    char* buffer;
+    unsigned index;             // registered buffer index
+    struct copy_block* next;    // free list
+} __attribute__((aligned(8)));
+
+
+//global app reference to uring interface
+struct raw_ring ring;
+
+unsigned block_size = BLOCK_SIZE_KB * 1024;
+struct copy_block* free_blocks;
+unsigned* free_slots;               // stack of slot pairs
+unsigned free_slot_count;
+unsigned to_submit;                 // SQEs published since the last io_uring_enter
+unsigned long enters;
+unsigned pending;                   // chains and pairs whose last CQE hasn't come in
+
+// page cache bypass on both sides, the unaligned end of a file is written whole and cut with truncate()
+int direct_io;
+
+// files opened and preallocated, with blocks left to copy. oldest first, so they give their slots back soon
+struct copy_file* ready_head;
+struct copy_file* ready_tail;
+
+// what the walk found
+struct copy_file* files;
+unsigned long file_count;
+unsigned long file_size;
+unsigned long dirs;
+unsigned long links;
+unsigned long skipped;
+
+// results
+unsigned long copied_files;
+unsigned long copied_bytes;
+unsigned long failed_files;
+unsigned long chained_files;        // copied by a single chain
+
+
+//  init uring interface
+int init_uring() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int res = ring_init(&ring, URING_QUEUE_SIZE, &p);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-res));
+        return 1;
+    }
+    return 0;
+}
+
+// depth buffers in one page aligned allocation, pinned once so READ_FIXED and WRITE_FIXED skip mapping them
+int init_blocks(unsigned depth) {
+    char* memory;
+
+    if (posix_memalign((void**)&memory, DIRECT_ALIGN, (size_t)depth * block_size)) {
+        fprintf(stderr, "buffer pool allocation failed: %u x %u bytes\n", depth, block_size);
+        return 1;
+    }
+
+    struct copy_block* blocks = calloc(depth, sizeof(struct copy_block));
+    struct iovec* iovs = malloc(sizeof(struct iovec) * depth);
+
+    free_blocks = NULL;
+    for (unsigned i = 0; i < depth; i++) {
+        blocks[i].buffer = memory + (size_t)i * block_size;
+        blocks[i].index = i;
+        blocks[i].next = free_blocks;
+        free_blocks = &blocks[i];
+
+        iovs[i].iov_base = blocks[i].buffer;
+        iovs[i].iov_len = block_size;
+    }
+
+    int res = sys_io_uring_register(ring.fd, IORING_REGISTER_BUFFERS, iovs, depth);
+    free(iovs);
+
+    if (res < 0) {
+        perror("io_uring_register buffers failed, RLIMIT_MEMLOCK may be too low");
+        return 1;
+    }
+    return 0;
+}
+
+// a sparse table of two direct descriptors per open file, kernel 5.19
+int init_slots(unsigned depth) {
+    struct io_uring_rsrc_register reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = 2 * depth;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+    if (sys_io_uring_register(ring.fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0) {
+        perror("registering a sparse file table failed, kernel 5.19 required");
+        return 1;
+    }
+
+    free_slots = malloc(sizeof(unsigned) * depth);
+    for (free_slot_count = 0; free_slot_count < depth; free_slot_count++) {
+        free_slots[free_slot_count] = free_slot_count;
+    }
+    return 0;
+}
+
+void release_block(struct copy_block* block) {
+    block->next = free_blocks;
+    free_blocks = block;
+}
+
+
+
+// takes ownership of src and dst
+void add_file(char* src, char* dst, struct stat* st) {
+    if (file_count == file_size) {
+        file_size = file_size ? 2 * file_size : 1024;
+        files = realloc(files, sizeof(struct copy_file) * file_size);
+    }
+
+    struct copy_file* file = &files[file_count++];
+    memset(file, 0, sizeof(*file));
+    file->src = src;
+    file->dst = dst;
+    file->size = st->st_size;
+    file->mode = st->st_mode & 07777;
+}
+
+char* join_path(const char* dir, const char* name) {
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+// recreates directories and symlinks on the spot, queues regular files. takes ownership of src and dst,
+// returns 1 if the destination can't be written
+int walk(char* src, char* dst) {
+    struct stat st;
+
+    if (lstat(src, &st) < 0) {
+        fprintf(stderr, "stat error: %s, file %s\n", strerror(errno), src);
+        failed_files++;
+        free(src);
+        free(dst);
+        return 0;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        add_file(src, dst, &st);
+        return 0;
+    }
+
+    int res = 0;
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlink(src, target, sizeof(target) - 1);
+
+        if (len >= 0) {
+            target[len] = '\0';
+            if (symlink(target, dst) == 0) {
+                links++;
+            } else {
+                fprintf(stderr, "symlink error: %s, file %s\n", strerror(errno), dst);
+                failed_files++;
+            }
+        }
+    }
+    else if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(src);
+
+        // the owner keeps write access while the tree is copied
+        if (mkdir(dst, (st.st_mode & 07777) | S_IRWXU) < 0 && errno != EEXIST) {
+            fprintf(stderr, "mkdir error: %s, directory %s\n", strerror(errno), dst);
+            res = 1;
+        }
+        else if (dir == NULL) {
+            fprintf(stderr, "opendir error: %s, directory %s\n", strerror(errno), src);
+            failed_files++;
+        }
+        else {
+            struct dirent* entry;
+
+            dirs++;
+            while (res == 0 && (entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                    continue;
+                }
+                res = walk(join_path(src, entry->d_name), join_path(dst, entry->d_name));
+            }
+        }
+
+        if (dir) {
+            closedir(dir);
+        }
+    }
+    else {
+        // devices, fifos and sockets
+        fprintf(stderr, "skipping %s, not a regular file, directory or symlink\n", src);
+        skipped++;
+    }
+
+    free(src);
+    free(dst);
+    return res;
+}
+
+
+
+void ready_push(struct copy_file* file) {
+    file->next = NULL;
+    if (ready_tail) {
+        ready_tail->next = file;
+    } else {
+        ready_head = file;
+    }
+    ready_tail = file;
+}
+
+void prep_open(struct copy_file* file, int op, unsigned flags) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&ring);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    if (op == COPY_OP_OPEN_SRC) {
+        sqe->addr = (unsigned long) file->src;
+        sqe->open_flags = direct_io ? O_RDONLY | O_DIRECT : O_RDONLY;
+        sqe->file_index = 2 * file->slot + 1;
+    } else {
+        sqe->addr = (unsigned long) file->dst;
+        sqe->open_flags = (direct_io ? O_WRONLY | O_DIRECT : O_WRONLY) | O_CREAT | O_TRUNC;
+        sqe->len = file->mode;
+        sqe->file_index = 2 * file->slot + 2;
+    }
+    sqe->flags = flags;
+    sqe->user_data = (unsigned long long) file | op;
+}
+
+void prep_rw(struct copy_block* block, int op, unsigned len, unsigned flags) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&ring);
+
+    sqe->opcode = op == COPY_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->fd = 2 * block->file->slot + (op == COPY_OP_WRITE);
+    sqe->addr = (unsigned long) block->buffer + block->done;
+    sqe->len = len;
+    sqe->off = block->offset + block->done;
+    sqe->buf_index = block->index;
+    sqe->flags = IOSQE_FIXED_FILE | flags;
+    sqe->user_data = (unsigned long long) block | op;
+}
+
+// both descriptors go, hard links so the second close runs whatever happened to the first
+void prep_close(struct copy_file* file, unsigned flags) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&ring);
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 2 * file->slot + 1;
+    sqe->flags = flags | IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = (unsigned long long) file | COPY_OP_CLOSE_SRC;
+
+    sqe = ring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 2 * file->slot + 2;
+    sqe->user_data = (unsigned long long) file | COPY_OP_CLOSE;
+}
+
+// a soft link that fails cancels the rest of its chain, closes included. when it had CQE_SKIP_SUCCESS the
+// cancelled SQEs post nothing either, so its own CQE is the end of the chain. the descriptors left behind
+// are replaced by the next openat into their slots
+void start_file(struct copy_file* file) {
+    file->slot = free_slots[--free_slot_count];
+    pending++;
+
+    if (file->single) {
+        struct copy_block* block = free_blocks;
+        free_blocks = block->next;
+
+        block->file = file;
+        block->offset = 0;
+        block->len = file->size;
+        block->done = 0;
+        block->read_res = 0;
+        block->tail = 0;
+        file->block = block;
+        file->inflight = 1;
+
+        // a read that comes up short breaks the link, the write is cancelled
+        prep_open(file, COPY_OP_OPEN_SRC, IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS);
+        prep_open(file, COPY_OP_OPEN_DST, IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS);
+        prep_rw(block, COPY_OP_READ, block->len, IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS);
+        prep_rw(block, COPY_OP_WRITE, block->len, IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS);
+        prep_close(file, 0);
+        chained_files++;
+        return;
+    }
+
+    // a single write allocates a one block file in one go anyway, larger ones get their extent up front
+    file->preallocate = file->size > block_size;
+
+    prep_open(file, COPY_OP_OPEN_SRC, IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS);
+    prep_open(file, COPY_OP_OPEN_DST, file->preallocate ? IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS : 0);
+
+    if (file->preallocate) {
+        struct io_uring_sqe* sqe = ring_get_sqe(&ring);
+
+        sqe->opcode = IORING_OP_FALLOCATE;
+        sqe->fd = 2 * file->slot + 1;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->off = 0;
+        sqe->addr = file->size;     // the length goes in addr
+        sqe->len = 0;               // mode
+        sqe->user_data = (unsigned long long) file | COPY_OP_FALLOCATE;
+    }
+}
+
+void close_file(struct copy_file* file) {
+    pending++;
+    prep_close(file, 0);
+}
+
+// queues the read->write pair of a block, or its unlinked read at the O_DIRECT tail of a file
+void submit_block(struct copy_block* block) {
+    unsigned len = block->len - block->done;
+
+    pending++;
+    block->read_res = 0;
+
+    if (block->tail) {
+        prep_rw(block, COPY_OP_READ, (len + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1), 0);
+        return;
+    }
+
+    prep_rw(block, COPY_OP_READ, len, IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS);
+    prep_rw(block, COPY_OP_WRITE, len, 0);
+}
+
+// hands the free buffers to the oldest open files
+void fill_blocks() {
+    while (ready_head && free_blocks) {
+        struct copy_file* file = ready_head;
+
+        // failed with blocks left, its last pair back closes it
+        if (file->next_offset >= file->size) {
+            ready_head = file->next;
+            if (ready_head == NULL) {
+                ready_tail = NULL;
+            }
+            continue;
+        }
+
+        struct copy_block* block = free_blocks;
+        free_blocks = block->next;
+
+        block->file = file;
+        block->offset = file->next_offset;
+        block->len = file->size - file->next_offset < block_size ? file->size - file->next_offset : block_size;
+        block->done = 0;
+        block->tail = direct_io && block->len % DIRECT_ALIGN;
+        file->next_offset += block->len;
+        file->inflight++;
+
+        submit_block(block);
+
+        if (file->next_offset >= file->size) {
+            ready_head = file->next;
+            if (ready_head == NULL) {
+                ready_tail = NULL;
+            }
+        }
+    }
+}
+
+// the open chain is done: copy the blocks, or close right away if it failed or there are none
+void file_opened(struct copy_file* file) {
+    if (file->failed || file->size == 0) {
+        close_file(file);
+    } else {
+        ready_push(file);
+    }
+}
+
+// no more blocks are queued for a failed file, it's closed once the ones in flight are back
+void file_failed(struct copy_file* file, const char* op, const char* path, int res) {
+    if (!file->failed) {
+        fprintf(stderr, "%s error: %s, file %s\n", op, strerror(-res), path);
+    }
+    file->failed = 1;
+    file->next_offset = file->size;
+}
+
+// a pair or a tail write is over, the block is done with unless part of it is left
+void block_written(struct copy_block* block, int res) {
+    struct copy_file* file = block->file;
+    unsigned len = block->len - block->done;
+
+    // a single chain posts here only when it failed, it isn't retried
+    if (file->single) {
+        if (res == -ECANCELED) {
+            file_failed(file, "read", file->src, block->read_res < 0 ? block->read_res : -ENODATA);
+        } else {
+            file_failed(file, "write", file->dst, res < 0 ? res : -EIO);
+        }
+        return;
+    }
+
+    if (res == -ECANCELED) {
+        file_failed(file, "read", file->src, block->read_res < 0 ? block->read_res : -ENODATA);
+    }
+    else if (res < 0) {
+        file_failed(file, "write", file->dst, res);
+    }
+    else {
+        block->done += (unsigned)res < len ? res : len;
+        file->copied += (unsigned)res < len ? res : len;
+    }
+
+    if (!file->failed && block->done < block->len) {
+        submit_block(block);
+        return;
+    }
+
+    file->inflight--;
+    release_block(block);
+    if (file->inflight == 0 && (file->failed || file->next_offset >= file->size)) {
+        close_file(file);
+    }
+}
+
+void file_closed(struct copy_file* file, int res) {
+    if (res < 0 && !file->failed) {
+        file_failed(file, "close", file->dst, res);
+    }
+
+    if (file->single) {
+        release_block(file->block);
+    }
+    free_slots[free_slot_count++] = file->slot;
+
+    // O_DIRECT wrote the tail block whole
+    if (!file->failed && direct_io && file->size % DIRECT_ALIGN && truncate(file->dst, file->size) < 0) {
+        file_failed(file, "truncate", file->dst, -errno);
+    }
+
+    if (file->failed) {
+        failed_files++;
+    } else {
+        copied_files++;
+        copied_bytes += file->size;
+    }
+}
+
+int copy_cqes() {
+    struct io_uring_cqe* cqe;
+    unsigned head, tail;
+
+    head = ring_cq_head(&ring);
+    tail = ring_cq_tail(&ring);
+
+    for (; head != tail; head++) {
+        cqe = ring_cqe_at(&ring, head);
+        void* data = (void*) (unsigned long) (cqe->user_data & ~(unsigned long long)COPY_OP_MASK);
+        int op = cqe->user_data & COPY_OP_MASK;
+        struct copy_file* file = data;
+        struct copy_block* block = data;
+        int res = cqe->res;
+
+        switch (op) {
+            case COPY_OP_OPEN_SRC:
+            case COPY_OP_OPEN_DST:
+                // only a failure posts, except for the last SQE of an open chain. either way the chain is over
+                if (res < 0) {
+                    file_failed(file, "openat", op == COPY_OP_OPEN_SRC ? file->src : file->dst, res);
+                }
+                pending--;
+                if (file->single) {
+                    file_closed(file, 0);
+                } else {
+                    file_opened(file);
+                }
+                break;
+
+            case COPY_OP_FALLOCATE:
+                // some filesystems can't preallocate, the copy goes on without it
+                if (res < 0 && res != -EOPNOTSUPP) {
+                    file_failed(file, "fallocate", file->dst, res);
+                }
+                pending--;
+                file_opened(file);
+                break;
+
+            case COPY_OP_READ: {
+                unsigned len = block->len - block->done;
+                block->read_res = res;
+
+                // O_DIRECT tail: the whole aligned length goes out, truncate() cuts it back
+                if (block->tail && res >= (int)len) {
+                    prep_rw(block, COPY_OP_WRITE, (len + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1), 0);
+                    break;
+                }
+
+                // a linked read posts when it failed or came up short, and the write after it never ran.
+                // what a short one got is written on its own, the next pair finds out if the file shrank
+                if (!block->tail && !block->file->single && !direct_io && res > 0) {
+                    prep_rw(block, COPY_OP_WRITE, res, 0);
+                    break;
+                }
+
+                pending--;
+                block_written(block, -ECANCELED);
+                if (block->file->single) {
+                    file_closed(block->file, 0);
+                }
+                break;
+            }
+
+            case COPY_OP_WRITE:
+                if (!block->file->single) {
+                    pending--;
+                }
+                block_written(block, res);
+                break;
+
+            case COPY_OP_CLOSE_SRC:
+                if (res != -ECANCELED) {
+                    file_failed(file, "close", file->src, res);
+                }
+                break;
+
+            case COPY_OP_CLOSE:
+                pending--;
+                file_closed(file, res == -ECANCELED ? 0 : res);
+                break;
+        }
+    }
+
+    ring_cq_advance(&ring, head);
+
+    return 0;
+}
+
+// copies every file the walk found with at most depth blocks in flight
+int copy_files(unsigned depth) {
+    unsigned long next_file = 0;
+
+    while (1) {
+        // open files get the buffers first, they hold slots
+        fill_blocks();
+
+        while (next_file < file_count && free_slot_count) {
+            struct copy_file* file = &files[next_file];
+
+            file->single = !direct_io && file->size > 0 && file->size <= block_size;
+            if (file->single && free_blocks == NULL) {
+                break;
+            }
+            start_file(file);
+            next_file++;
+        }
+
+        if (pending == 0) {
+            break;
+        }
+
+        //make the batch known to the kernel with one tail update, submit it and wait for at least one ready
+        to_submit += ring_flush(&ring);
+        enters++;
+        int res = sys_io_uring_enter(ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if(res < 0) {
+            perror("io_uring_enter error");
+            return 1;
+        }
+        to_submit -= res;
+
+        copy_cqes();
+    }
+
+    return 0;
+}
+
+
+
+double cpu_seconds() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+    unsigned depth = QUEUE_DEPTH;
+    int sync_after = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "q:b:dSh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'q':
+                depth = strtol(optarg, NULL, 10);
+                if (depth < 1 || depth > MAX_DEPTH) {
+                    fprintf(stderr, "Queue depth must be > 0 and <= %i\n", MAX_DEPTH);
+                    return 1;
+                }
+                break;
+            case 'b':
+                block_size = strtol(optarg, NULL, 10) * 1024;
+                if (block_size == 0) {
+                    fprintf(stderr, "Block size must be > 0 KiB\n");
+                    return 1;
+                }
+                break;
+            case 'd':
+                direct_io = 1;
+                break;
+            case 'S':
+                sync_after = 1;
+                break;
+            case 'h':
+                printf("usage: %s [options] source... destination\n", argv[0]);
+                printf("      copies files and directory trees like cp -r. with several sources, or when it exists, \n");
+                printf("      the destination is a directory to copy into \n");
+                printf("      -q: blocks in flight, also the most files open at once. defaults to %i \n", QUEUE_DEPTH);
+                printf("      -b: block size in KiB, each file is copied in read->write pairs of this size. defaults to %i \n", BLOCK_SIZE_KB);
+                printf("      -d: bypass the page cache, O_DIRECT on both sides \n");
+                printf("      -S: syncfs() the destination before the clock stops, the copy is then on disk \n");
+                return 0;
+        }
+    }
+
+    if (argc - optind < 2) {
+        fprintf(stderr, "Need a source and a destination\n");
+        return 1;
+    }
+
+    if (direct_io && block_size % DIRECT_ALIGN) {
+        fprintf(stderr, "O_DIRECT blocks must be a multiple of %i bytes\n", DIRECT_ALIGN);
+        return 1;
+    }
+
+    if (init_uring() || init_slots(depth) || init_blocks(depth)) {
+        return 1;
+    }
+
+    char* target = argv[argc - 1];
+    struct stat st;
+    int into = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+
+    if (argc - optind > 2 && !into) {
+        fprintf(stderr, "Target %s is not a directory\n", target);
+        return 1;
+    }
+
+    printf("Copying %i source%s to %s, %u KiB blocks, depth %u, %s\n", argc - optind - 1, argc - optind > 2 ? "s" : "", target,
+           block_size / 1024, depth, direct_io ? "O_DIRECT" : "buffered");
+
+    double cpu_start = cpu_seconds();
+    double start = now_seconds();
+
+    for (int i = optind; i < argc - 1; i++) {
+        char* src = strdup(argv[i]);
+        char* dst = into ? join_path(target, basename(src)) : strdup(target);
+
+        if (walk(strdup(argv[i]), dst)) {
+            return 1;
+        }
+        free(src);
+    }
+
+    double walked = now_seconds() - start;
+
+    if (copy_files(depth)) {
+        return 1;
+    }
+
+    double copied = now_seconds();
+
+    if (sync_after) {
+        int fd = open(target, O_RDONLY);
+        if (fd < 0 || syncfs(fd) < 0) {
+            perror("syncfs failed");
+        }
+        close(fd);
+    }
+
+    double elapsed = now_seconds() - start;
+    double cpu = cpu_seconds() - cpu_start;
+
+    printf("--- %lu bytes in %lu files, %.3f s, %.1f MB/s, %.0f files/s, %.2f cpu s/GB, %lu enters\n", copied_bytes, copied_files, elapsed,
+           copied_bytes / elapsed / 1e6, copied_files / elapsed, copied_bytes ? cpu / (copied_bytes / 1e9) : 0.0, enters);
+    printf("--- %lu directories, %lu symlinks, %lu files in one chain; walk %.3f s\n", dirs, links, chained_files, walked);
+
+    if (sync_after) {
+        printf("--- syncfs %.3f s of the total\n", elapsed - (copied - start));
+    }
+
+    if (failed_files || skipped) {
+        printf("--- %lu failed, %lu skipped\n", failed_files, skipped);
+    }
+
+    ring_exit(&ring);
+    printf("\n...done\n");
+
+    return failed_files ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+#!/bin/sh
+# copies a tree with sizes on the 4 KiB and block boundaries, empty files, symlinks and odd modes
+# through 3_uring_copy, buffered and with -d at a few depths and block sizes, and diffs each copy.
+# then copies next to a source that fails, which has to be reported once and not disturb the rest.
+# usage: ./copy_check.sh [scratch dir], O_DIRECT needs one that isn't on tmpfs. defaults to /var/tmp
+
+set -e
+
+COPY=$(dirname "$0")/3_uring_copy
+SCRATCH=$(mktemp -d "${1:-/var/tmp}/copy_check.XXXXXX")
+trap 'rm -rf "$SCRATCH"' EXIT
+
+SRC=$SCRATCH/src
+mkdir -p "$SRC/a/b/c" "$SRC/empty_dir" "$SRC/modes"
+
+# around 4 KiB and the 4, 128 and 1024 KiB blocks used below
+for size in 0 1 511 4095 4096 4097 8191 12288 131071 131072 131073 266239 1048575 1048576 1048577 3149823; do
+    head -c $size /dev/urandom > "$SRC/f_$size"
+    head -c $size /dev/urandom > "$SRC/a/b/c/f_$size"
+done
+
+# more files than -q at the smaller depths, so slots get reused
+for i in $(seq 1 200); do
+    head -c $((i * 97)) /dev/urandom > "$SRC/a/b/small_$i"
+done
+
+for mode in 400 444 600 640 700 755; do
+    head -c 5000 /dev/urandom > "$SRC/modes/m_$mode"
+    chmod $mode "$SRC/modes/m_$mode"
+done
+chmod 750 "$SRC/a/b"
+
+ln -s f_4097 "$SRC/link_file"
+ln -s a/b "$SRC/link_dir"
+ln -s does/not/exist "$SRC/link_dangling"
+ln -s ../../f_1 "$SRC/a/b/link_up"
+
+# name, type and mode of everything, diff -r doesn't look at modes
+listing() {
+    (cd "$1" && find . -printf '%p %y %m\n' | sort)
+}
+
+listing "$SRC" > "$SCRATCH/src.list"
+
+failed=0
+run=0
+
+for direct in "" -d; do
+    for queue in 1 8 64; do
+        for block in 4 128 1024; do
+            run=$((run + 1))
+            dst=$SCRATCH/dst_$run
+            opts="-q $queue -b $block${direct:+ $direct}"
+
+            if ! "$COPY" $opts "$SRC" "$dst" > "$SCRATCH/out" 2>&1; then
+                echo "FAIL $opts: copy failed"
+                cat "$SCRATCH/out"
+                failed=$((failed + 1))
+            elif ! diff -r --no-dereference "$SRC" "$dst" > "$SCRATCH/out" 2>&1 ||
+                 ! listing "$dst" | diff "$SCRATCH/src.list" - >> "$SCRATCH/out"; then
+                echo "FAIL $opts: copy differs"
+                head -20 "$SCRATCH/out"
+                failed=$((failed + 1))
+            else
+                echo "ok   $opts"
+            fi
+            rm -rf "$dst"
+        done
+    done
+done
+
+# a source that fails mid-copy: sysfs attributes stat as 4096 bytes and read far less, with 1 and 2 KiB
+# blocks the short read fails the file with blocks still to queue. -d fails its O_DIRECT open instead. the copy has to
+# report exactly that one file and still copy everything next to it
+BAD=
+for f in /sys/kernel/mm/transparent_hugepage/enabled /sys/kernel/mm/transparent_hugepage/defrag /sys/kernel/warn_count; do
+    if [ -r "$f" ] && [ "$(stat -c %s "$f")" -gt "$(head -c 8192 "$f" | wc -c)" ]; then
+        BAD=$f
+        break
+    fi
+done
+
+if [ -z "$BAD" ]; then
+    echo "skip failing source: no sysfs attribute found"
+else
+    for direct in "" -d; do
+        [ -z "$direct" ] && blocks="1 2" || blocks="4 8"
+        for queue in 1 8; do
+            for block in $blocks; do
+                run=$((run + 1))
+                dst=$SCRATCH/dst_$run
+                opts="-q $queue -b $block${direct:+ $direct}"
+
+                mkdir "$dst"
+                "$COPY" $opts "$BAD" "$SRC/f_1048577" "$SRC/a" "$dst" > "$SCRATCH/out" 2>&1 && res=0 || res=$?
+
+                if [ $res -ne 1 ] || ! grep -q -- "--- 1 failed," "$SCRATCH/out"; then
+                    echo "FAIL $opts: failing source not reported once, exit $res"
+                    cat "$SCRATCH/out"
+                    failed=$((failed + 1))
+                elif ! cmp -s "$SRC/f_1048577" "$dst/f_1048577" || ! diff -r --no-dereference "$SRC/a" "$dst/a" > "$SCRATCH/out" 2>&1; then
+                    echo "FAIL $opts: copy next to the failing source differs"
+                    head -20 "$SCRATCH/out"
+                    failed=$((failed + 1))
+                else
+                    echo "ok   $opts, failing source"
+                fi
+                rm -rf "$dst"
+            done
+        done
+    done
+fi
+
+echo "$((run - failed)) of $run copies as expected"
+[ $failed -eq 0 ]
@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "crc32c.h"
+
+// reflected Castagnoli polynomial. bit 0 of a CRC is the x^31 coefficient
+#define POLY 0x82f63b78
+
+// 3 streams of crc32 run in parallel, the instruction has a latency of 3 and a throughput of 1
+#define LONG_BLOCK 8192
+#define SHORT_BLOCK 256
+
+
+static uint32_t table[8][256];      // slicing-by-8
+static uint32_t x2n_table[64];      // x^(2^n) mod P
+
+// multipliers that move a stream's CRC past the streams after it, for PCLMUL
+static uint32_t long_k1, long_k2, short_k1, short_k2;
+
+static int have_sse42, have_pclmul;
+
+
+// a * b mod P
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    while (m) {
+        if (a & m) {
+            p ^= b;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^n mod P
+static uint32_t xnmodp(uint64_t n)
+{
+    uint32_t p = (uint32_t)1 << 31;     // x^0
+    int k = 0;
+
+    while (n) {
+        if (n & 1) {
+            p = multmodp(x2n_table[k], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+uint32_t crc32c_shift(uint32_t crc, uint64_t len)
+{
+    return multmodp(xnmodp(len * 8), crc);
+}
+
+
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char* p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^ table[5][(v >> 16) & 0xff] ^ table[4][(v >> 24) & 0xff] ^
+              table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^ table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// crc * x^(8 * block) mod P for the two earlier streams, one reduction for both.
+// clmul of two reflected 32 bit values is the product times x, crc32 of it multiplies by x^32,
+// so k = x^(8 * block - 33)
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t combine_pclmul(uint32_t crc0, uint32_t k0, uint32_t crc1, uint32_t k1)
+{
+    __m128i a = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc0), _mm_cvtsi32_si128(k0), 0);
+    __m128i b = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc1), _mm_cvtsi32_si128(k1), 0);
+
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(_mm_xor_si128(a, b)));
+}
+
+// 3 interleaved streams over blocks of block bytes each, the CRC goes in and out of stream 0
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_3way(uint32_t crc, const unsigned char** data, size_t* len, size_t block, uint32_t k1, uint32_t k2)
+{
+    const unsigned char* p = *data;
+
+    while (*len >= 3 * block) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        const unsigned char* end = p + block;
+
+        while (p < end) {
+            crc0 = _mm_crc32_u64(crc0, *(const uint64_t*)p);
+            crc1 = _mm_crc32_u64(crc1, *(const uint64_t*)(p + block));
+            crc2 = _mm_crc32_u64(crc2, *(const uint64_t*)(p + 2 * block));
+            p += 8;
+        }
+
+        if (have_pclmul) {
+            crc = combine_pclmul(crc0, k1, crc1, k2) ^ crc2;
+        } else {
+            crc = crc32c_shift(crc32c_shift(crc0, block) ^ crc1, block) ^ crc2;
+        }
+        p += 2 * block;
+        *len -= 3 * block;
+    }
+
+    *data = p;
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+    crc = crc32c_3way(crc, &p, &len, LONG_BLOCK, long_k1, long_k2);
+    crc = crc32c_3way(crc, &p, &len, SHORT_BLOCK, short_k1, short_k2);
+
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, *(const uint64_t*)p);
+        p += 8;
+        len -= 8;
+    }
+    crc = crc64;
+
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+uint32_t crc32c_raw(uint32_t crc, const void* data, size_t len)
+{
+    return have_sse42 ? crc32c_hw(crc, data, len) : crc32c_sw(crc, data, len);
+}
+
+
+
+void crc32c_init()
+{
+    for (unsigned n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][n] = crc;
+    }
+    for (unsigned n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++) {
+            table[k][n] = table[0][table[k - 1][n] & 0xff] ^ (table[k - 1][n] >> 8);
+        }
+    }
+
+    uint32_t p = (uint32_t)1 << 30;     // x^1
+    for (int n = 0; n < 64; n++) {
+        x2n_table[n] = p;
+        p = multmodp(p, p);
+    }
+
+    // stream 0 moves past two blocks, stream 1 past one
+    long_k1 = xnmodp(8 * 2 * LONG_BLOCK - 33);
+    long_k2 = xnmodp(8 * LONG_BLOCK - 33);
+    short_k1 = xnmodp(8 * 2 * SHORT_BLOCK - 33);
+    short_k2 = xnmodp(8 * SHORT_BLOCK - 33);
+
+    __builtin_cpu_init();
+    have_sse42 = __builtin_cpu_supports("sse4.2");
+    have_pclmul = __builtin_cpu_supports("pclmul");
+}
+
+const char* crc32c_impl()
+{
+    if (!have_sse42) {
+        return "slicing-by-8";
+    }
+    return have_pclmul ? "sse4.2 3-way + pclmul" : "sse4.2 3-way";
+}
@@ -0,0 +1,29 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+// CRC32C (Castagnoli), the iSCSI/ext4/btrfs checksum. the SSE4.2 crc32 instruction does it in
+// hardware, PCLMUL combines interleaved streams, a slicing-by-8 table is the fallback
+
+#include <stddef.h>
+#include <stdint.h>
+
+// picks the fastest kernel the CPU has, call once before anything else
+void crc32c_init();
+
+// name of the kernel in use
+const char* crc32c_impl();
+
+// the bare CRC register: no inversion going in or out. linear, so the CRC of a buffer can be put
+// together from the CRCs of its pieces with crc32c_shift()
+uint32_t crc32c_raw(uint32_t crc, const void* data, size_t len);
+
+// moves a raw CRC past len zero bytes: raw(crc, A || B) == shift(raw(crc, A), |B|) ^ raw(0, B)
+uint32_t crc32c_shift(uint32_t crc, uint64_t len);
+
+// the standard CRC32C of a buffer, crc32c("123456789", 9) == 0xe3069283
+static inline uint32_t crc32c(const void* data, size_t len)
+{
+    return ~crc32c_raw(~0u, data, len);
+}
+
+#endif
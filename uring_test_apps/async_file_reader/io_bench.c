@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "raw_ring.h"
+
+#define BLOCK_SIZE_KB 4         // default I/O size
+#define QUEUE_DEPTH 32          // default I/Os in flight per ring
+#define FILE_SIZE_MB 1024       // default test file size
+#define RUNTIME_SEC 5
+#define MAX_THREADS 64
+#define DIRECT_ALIGN 4096       // O_DIRECT offsets, lengths and buffers are multiples of this
+#define SQ_IDLE_MSEC 1000
+#define PREP_CHUNK (1 << 20)    // the test file is written in pieces of this size
+
+// latency histogram: 16 linear buckets per power of two, values within 1/16 of the truth
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+// fio-style load on one file: every ring has its own thread, fd and region of the file. each I/O is a read
+// or a write and goes to a random or the next sequential block, as picked by the mix
+
+struct bench_io {
+    unsigned index;             // buffer, and registered buffer index
+    int write;
+    uint64_t start_ns;
+};
+
+struct bench_thread {
+    int id;
+    pthread_t thread;
+    struct raw_ring ring;
+    int fd;
+    off_t region;               // start of this ring's part of the file
+    off_t region_blocks;
+    off_t next_block;           // sequential stream position
+    uint64_t rng;
+    struct bench_io* ios;
+    char* buffers;
+    unsigned to_submit;
+    unsigned long enters;
+    unsigned long wakeups;      // SQPOLL poller found asleep
+    unsigned long done[2];      // reads, writes
+    unsigned long bytes[2];
+    unsigned long hist[2][HIST_BUCKETS];
+    int error;
+};
+
+
+//job
+char* filename;
+unsigned block_size = BLOCK_SIZE_KB * 1024;
+unsigned depth = QUEUE_DEPTH;
+unsigned random_pct = 100;      // share of I/Os going to a random block, the rest continue the sequential stream
+unsigned write_pct = 0;
+off_t file_size = (off_t)FILE_SIZE_MB << 20;
+unsigned thread_count = 1;
+double runtime = RUNTIME_SEC;
+
+//ring and file setup
+int direct_io;
+int fixed_buffers;
+int fixed_files;
+int polled_io;                  // IORING_SETUP_IOPOLL, needs O_DIRECT and a driver with poll queues
+int sq_poll;
+int invalidate;                 // drop the file's page cache before the run
+
+uint64_t deadline_ns;
+struct bench_thread threads[MAX_THREADS];
+
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+double cpu_seconds() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// xorshift64*, one stream per thread
+uint64_t next_random(struct bench_thread* t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 0x2545f4914f6cdd1dull;
+}
+
+
+
+unsigned hist_bucket(uint64_t ns) {
+    if (ns < 2 * HIST_SUB) {
+        return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+    unsigned bucket = (shift + 1) * HIST_SUB + ((ns >> shift) & (HIST_SUB - 1));
+
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+// lowest value of a bucket
+uint64_t hist_value(unsigned bucket) {
+    if (bucket < 2 * HIST_SUB) {
+        return bucket;
+    }
+    int shift = bucket / HIST_SUB - 1;
+    return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+}
+
+// the value below which pct percent of the samples are
+uint64_t hist_percentile(unsigned long* hist, unsigned long count, double pct) {
+    unsigned long rank = count * pct / 100;
+    unsigned long seen = 0;
+
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            return hist_value(b);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+
+
+// the file is written out in full before the run, reads of holes would never reach the device
+int prepare_file() {
+    struct stat st;
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        fprintf(stderr, "open error: %s, file %s\n", strerror(errno), filename);
+        return 1;
+    }
+
+    // block devices are used as they are
+    fstat(fd, &st);
+    if (!S_ISREG(st.st_mode) || st.st_blocks * 512 >= file_size) {
+        close(fd);
+        return 0;
+    }
+
+    printf("Writing %lli MiB to %s\n", (long long)(file_size >> 20), filename);
+
+    char* chunk = malloc(PREP_CHUNK);
+    uint64_t* words = (uint64_t*)chunk;
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    for (unsigned i = 0; i < PREP_CHUNK / 8; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        words[i] = x;
+    }
+
+    for (off_t offset = 0; offset < file_size; offset += PREP_CHUNK) {
+        size_t len = file_size - offset < PREP_CHUNK ? file_size - offset : PREP_CHUNK;
+
+        // a different first word per chunk keeps the file from deduplicating
+        words[0] = offset;
+        if (pwrite(fd, chunk, len, offset) != (ssize_t)len) {
+            perror("writing the test file failed");
+            return 1;
+        }
+    }
+
+    free(chunk);
+    fsync(fd);
+    close(fd);
+    return 0;
+}
+
+int setup_thread(struct bench_thread* t) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    if (polled_io) {
+        p.flags |= IORING_SETUP_IOPOLL;
+    }
+    if (sq_poll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQ_IDLE_MSEC;
+    }
+
+    int res = ring_init(&t->ring, depth, &p);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-res));
+        return 1;
+    }
+
+    t->fd = open(filename, direct_io ? O_RDWR | O_DIRECT : O_RDWR);
+    if (t->fd < 0) {
+        fprintf(stderr, "open error: %s, file %s\n", strerror(errno), filename);
+        return 1;
+    }
+
+    if (fixed_files && sys_io_uring_register(t->ring.fd, IORING_REGISTER_FILES, &t->fd, 1) < 0) {
+        perror("io_uring_register files failed");
+        return 1;
+    }
+
+    if (posix_memalign((void**)&t->buffers, DIRECT_ALIGN, (size_t)depth * block_size)) {
+        fprintf(stderr, "buffer allocation failed: %u x %u bytes\n", depth, block_size);
+        return 1;
+    }
+    // written data is whatever the buffers hold, random bytes so it doesn't compress
+    for (size_t i = 0; i < (size_t)depth * block_size; i++) {
+        t->buffers[i] = next_random(t);
+    }
+
+    t->ios = calloc(depth, sizeof(struct bench_io));
+    for (unsigned i = 0; i < depth; i++) {
+        t->ios[i].index = i;
+    }
+
+    if (fixed_buffers) {
+        struct iovec* iovs = malloc(sizeof(struct iovec) * depth);
+
+        for (unsigned i = 0; i < depth; i++) {
+            iovs[i].iov_base = t->buffers + (size_t)i * block_size;
+            iovs[i].iov_len = block_size;
+        }
+
+        res = sys_io_uring_register(t->ring.fd, IORING_REGISTER_BUFFERS, iovs, depth);
+        free(iovs);
+
+        if (res < 0) {
+            perror("io_uring_register buffers failed, RLIMIT_MEMLOCK may be too low");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+// picks the next block and direction, and queues the I/O. the clock starts here
+void queue_io(struct bench_thread* t, struct bench_io* io) {
+    off_t block;
+
+    if (random_pct == 100 || (random_pct && next_random(t) % 100 < random_pct)) {
+        block = next_random(t) % t->region_blocks;
+    } else {
+        block = t->next_block;
+        t->next_block = (t->next_block + 1) % t->region_blocks;
+    }
+    io->write = write_pct == 100 || (write_pct && next_random(t) % 100 < write_pct);
+
+    struct io_uring_sqe* sqe = ring_get_sqe(&t->ring);
+
+    if (fixed_buffers) {
+        sqe->opcode = io->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = io->index;
+    } else {
+        sqe->opcode = io->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    if (fixed_files) {
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = t->fd;
+    }
+    sqe->addr = (unsigned long) (t->buffers + (size_t)io->index * block_size);
+    sqe->len = block_size;
+    sqe->off = t->region + block * block_size;
+    sqe->user_data = (unsigned long long) io;
+
+    io->start_ns = now_ns();
+}
+
+// publishes the queued I/Os. without SQPOLL they go in with the next io_uring_enter
+void submit_ios(struct bench_thread* t) {
+    unsigned published = ring_flush(&t->ring);
+
+    if (!sq_poll) {
+        t->to_submit += published;
+    }
+    else if (published && ring_sq_needs_wakeup(&t->ring)) {
+        t->wakeups++;
+        t->enters++;
+        sys_io_uring_enter(t->ring.fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }
+}
+
+// takes every completion there is, requeues the I/Os until the deadline. returns how many finished
+int reap_ios(struct bench_thread* t, int requeue) {
+    unsigned head = ring_cq_head(&t->ring);
+    unsigned tail = ring_cq_tail(&t->ring);
+    uint64_t now = now_ns();
+    int finished = 0;
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = ring_cqe_at(&t->ring, head);
+        struct bench_io* io = (struct bench_io*) cqe->user_data;
+
+        if (cqe->res < 0) {
+            // the first one says it, the rest of the queue most likely fails the same way
+            if (!t->error) {
+                fprintf(stderr, "%s error: %s, file %s%s\n", io->write ? "write" : "read", strerror(-cqe->res), filename,
+                        polled_io && cqe->res == -EOPNOTSUPP ? ", the device has no poll queues" : "");
+            }
+            t->error = 1;
+            requeue = 0;
+        }
+        else {
+            t->done[io->write]++;
+            t->bytes[io->write] += cqe->res;
+            t->hist[io->write][hist_bucket(now - io->start_ns)]++;
+        }
+
+        if (requeue) {
+            queue_io(t, io);
+        } else {
+            finished++;
+        }
+    }
+
+    ring_cq_advance(&t->ring, head);
+    return finished;
+}
+
+void* run_thread(void* arg) {
+    struct bench_thread* t = arg;
+    unsigned inflight = depth;
+
+    for (unsigned i = 0; i < depth; i++) {
+        queue_io(t, &t->ios[i]);
+    }
+    submit_ios(t);
+
+    while (inflight) {
+        // with SQPOLL there's nothing to submit, the call only waits
+        if (ring_cq_head(&t->ring) == ring_cq_tail(&t->ring)) {
+            t->enters++;
+            int res = sys_io_uring_enter(t->ring.fd, t->to_submit, 1, IORING_ENTER_GETEVENTS);
+            if (res < 0) {
+                perror("io_uring_enter error");
+                t->error = 1;
+                break;
+            }
+            t->to_submit -= res;
+        }
+
+        // stop requeueing at the deadline and drain what's in flight
+        inflight -= reap_ios(t, !t->error && now_ns() < deadline_ns);
+        submit_ios(t);
+    }
+    return NULL;
+}
+
+
+
+void print_direction(const char* name, int dir, double elapsed) {
+    static unsigned long hist[HIST_BUCKETS];
+    unsigned long count = 0, bytes = 0;
+
+    memset(hist, 0, sizeof(hist));
+    for (unsigned i = 0; i < thread_count; i++) {
+        count += threads[i].done[dir];
+        bytes += threads[i].bytes[dir];
+        for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+            hist[b] += threads[i].hist[dir][b];
+        }
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    unsigned long max = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        max = hist[b] ? b : max;
+    }
+
+    printf("%-5s IOPS %.0f, %.1f MB/s, lat usec p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", name,
+           count / elapsed, bytes / elapsed / 1e6,
+           hist_percentile(hist, count, 50) / 1e3, hist_percentile(hist, count, 90) / 1e3,
+           hist_percentile(hist, count, 99) / 1e3, hist_percentile(hist, count, 99.9) / 1e3, hist_value(max) / 1e3);
+}
+
+unsigned parse_pct(const char* arg, const char* what) {
+    long pct = strtol(arg, NULL, 10);
+
+    if (pct < 0 || pct > 100) {
+        fprintf(stderr, "%s must be between 0 and 100 percent\n", what);
+        exit(1);
+    }
+    return pct;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+    int opt;
+
+    while((opt = getopt(argc, argv, "b:q:r:w:s:t:T:dBFpPih")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b':
+                block_size = strtol(optarg, NULL, 10) * 1024;
+                if (block_size == 0) {
+                    fprintf(stderr, "Block size must be > 0 KiB\n");
+                    return 1;
+                }
+                break;
+            case 'q':
+                depth = strtol(optarg, NULL, 10);
+                if (depth < 1 || depth > 4096) {
+                    fprintf(stderr, "Queue depth must be > 0 and <= 4096\n");
+                    return 1;
+                }
+                break;
+            case 'r':
+                random_pct = parse_pct(optarg, "Random share");
+                break;
+            case 'w':
+                write_pct = parse_pct(optarg, "Write share");
+                break;
+            case 's':
+                file_size = (off_t)strtol(optarg, NULL, 10) << 20;
+                break;
+            case 't':
+                thread_count = strtol(optarg, NULL, 10);
+                if (thread_count < 1 || thread_count > MAX_THREADS) {
+                    fprintf(stderr, "Threads must be > 0 and <= %i\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'T':
+                runtime = strtod(optarg, NULL);
+                break;
+            case 'd':
+                direct_io = 1;
+                break;
+            case 'B':
+                fixed_buffers = 1;
+                break;
+            case 'F':
+                fixed_files = 1;
+                break;
+            case 'p':
+                polled_io = 1;
+                break;
+            case 'P':
+                sq_poll = 1;
+                break;
+            case 'i':
+                invalidate = 1;
+                break;
+            case 'h':
+                printf("usage: %s [options] file\n", argv[0]);
+                printf("      the file is created and filled first if it's smaller than -s \n");
+                printf("      -b: block size in KiB, defaults to %i \n", BLOCK_SIZE_KB);
+                printf("      -q: I/Os in flight per ring, defaults to %i \n", QUEUE_DEPTH);
+                printf("      -r: percent of I/Os to a random block, the rest are sequential. defaults to 100 \n");
+                printf("      -w: percent of I/Os that are writes, defaults to 0 \n");
+                printf("      -s: file size in MiB, split evenly between the rings. defaults to %i \n", FILE_SIZE_MB);
+                printf("      -t: rings, one thread each, defaults to 1 \n");
+                printf("      -T: run time in seconds, defaults to %i \n", RUNTIME_SEC);
+                printf("      -d: O_DIRECT \n");
+                printf("      -B: registered buffers, READ_FIXED and WRITE_FIXED \n");
+                printf("      -F: registered file \n");
+                printf("      -p: with -d, IOPOLL rings: completions are polled from the device, needs driver poll queues \n");
+                printf("      -P: SQPOLL rings, a kernel thread per ring submits \n");
+                printf("      -i: drop the file from the page cache before the run \n");
+                return 0;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "No file provided\n");
+        return 1;
+    }
+    filename = argv[optind];
+
+    if (polled_io && !direct_io) {
+        fprintf(stderr, "Polled completions (-p) only work with O_DIRECT (-d)\n");
+        return 1;
+    }
+
+    if (direct_io && block_size % DIRECT_ALIGN) {
+        fprintf(stderr, "O_DIRECT blocks must be a multiple of %i bytes\n", DIRECT_ALIGN);
+        return 1;
+    }
+
+    off_t region = file_size / thread_count / block_size * block_size;
+    if (region == 0) {
+        fprintf(stderr, "File too small for %u rings of %u byte blocks\n", thread_count, block_size);
+        return 1;
+    }
+
+    if (prepare_file()) {
+        return 1;
+    }
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        struct bench_thread* t = &threads[i];
+
+        t->id = i;
+        t->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        t->region = i * region;
+        t->region_blocks = region / block_size;
+
+        if (setup_thread(t)) {
+            return 1;
+        }
+    }
+
+    if (invalidate) {
+        posix_fadvise(threads[0].fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    printf("%u KiB blocks, depth %u x %u ring%s, %u%% random, %u%% writes, %lli MiB file, %.1f s: %s%s%s%s%s\n",
+           block_size / 1024, depth, thread_count, thread_count > 1 ? "s" : "", random_pct, write_pct,
+           (long long)(file_size >> 20), runtime, direct_io ? "O_DIRECT" : "buffered", fixed_buffers ? ", fixed buffers" : "",
+           fixed_files ? ", fixed file" : "", polled_io ? ", IOPOLL" : "", sq_poll ? ", SQPOLL" : "");
+
+    double cpu_start = cpu_seconds();
+    uint64_t start = now_ns();
+    deadline_ns = start + runtime * 1e9;
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i].thread, NULL, run_thread, &threads[i]);
+    }
+
+    unsigned long enters = 0, wakeups = 0;
+    int error = 0;
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        pthread_join(threads[i].thread, NULL);
+        enters += threads[i].enters;
+        wakeups += threads[i].wakeups;
+        error |= threads[i].error;
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+    double cpu = cpu_seconds() - cpu_start;
+
+    print_direction("read", 0, elapsed);
+    print_direction("write", 1, elapsed);
+
+    unsigned long ios = 0;
+    for (unsigned i = 0; i < thread_count; i++) {
+        ios += threads[i].done[0] + threads[i].done[1];
+    }
+
+    printf("--- %.3f s, %.2f cpu s, %.2f usec cpu per I/O, %lu enters (%lu poller wakeups), %.1f I/Os per enter\n", elapsed, cpu,
+           ios ? cpu * 1e6 / ios : 0.0, enters, wakeups, enters ? (double)ios / enters : 0.0);
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        ring_exit(&threads[i].ring);
+        close(threads[i].fd);
+    }
+
+    return error;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// liburing first, its io_uring.h guard then covers the kernel one raw_ring.h pulls in
+#include <liburing.h>
+
+#include "raw_ring.h"
+
+#define URING_QUEUE_SIZE  1024
+
+#define NOP_COUNT 2000000       // default NOPs per variant and batch size
+#define MAX_BATCHES 16
+
+// the fences 1_uring_read.c used before raw_ring.h: one around every tail store, one per CQE
+#define rmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
+#define wmb() __asm__ __volatile__("lock; addl $0,0(%%rsp)":::"memory")
+
+
+// runs count NOPs in batches, returns the NOPs completed or -1
+typedef long (*nop_loop)(long count, unsigned batch);
+
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int raw_setup(struct raw_ring* ring) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int res = ring_init(ring, URING_QUEUE_SIZE, &p);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-res));
+        ring_exit(ring);
+        return 1;
+    }
+    return 0;
+}
+
+
+
+// raw_ring.h: the batch goes out with one release store of the SQ tail, the CQ head is released once per drain
+long raw_loop(long count, unsigned batch) {
+    struct raw_ring ring;
+    long done = 0;
+
+    if (raw_setup(&ring)) {
+        return -1;
+    }
+
+    while (done < count) {
+        for (unsigned i = 0; i < batch; i++) {
+            struct io_uring_sqe* sqe = ring_get_sqe(&ring);
+            sqe->opcode = IORING_OP_NOP;
+        }
+
+        unsigned to_submit = ring_flush(&ring);
+        if (sys_io_uring_enter(ring.fd, to_submit, batch, IORING_ENTER_GETEVENTS) < 0) {
+            perror("io_uring_enter error \n");
+            ring_exit(&ring);
+            return -1;
+        }
+
+        unsigned head = ring_cq_head(&ring);
+        unsigned tail = ring_cq_tail(&ring);
+
+        for (; head != tail; head++) {
+            done += ring_cqe_at(&ring, head)->res == 0;
+        }
+        ring_cq_advance(&ring, head);
+    }
+
+    ring_exit(&ring);
+    return done;
+}
+
+// the old pattern: fence, tail store, fence for every SQE, a fence per CQE looked at
+long fenced_loop(long count, unsigned batch) {
+    struct raw_ring ring;
+    long done = 0;
+
+    if (raw_setup(&ring)) {
+        return -1;
+    }
+
+    while (done < count) {
+        for (unsigned i = 0; i < batch; i++) {
+            unsigned tail = *ring.sq.tail;
+            unsigned index = tail & *ring.sq.ring_mask;
+            struct io_uring_sqe* sqe = &ring.sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_NOP;
+            ring.sq.array[index] = index;
+            tail++;
+
+            wmb();
+            *ring.sq.tail = tail;
+            wmb();
+        }
+
+        if (sys_io_uring_enter(ring.fd, batch, batch, IORING_ENTER_GETEVENTS) < 0) {
+            perror("io_uring_enter error \n");
+            ring_exit(&ring);
+            return -1;
+        }
+
+        unsigned head = *ring.cq.head;
+
+        while (1) {
+            rmb();
+
+            if (head == *ring.cq.tail) {
+                break;
+            }
+            done += ring.cq.cqes[head & *ring.cq.ring_mask].res == 0;
+            head++;
+        }
+
+        *ring.cq.head = head;
+        wmb();
+    }
+
+    ring_exit(&ring);
+    return done;
+}
+
+long liburing_loop(long count, unsigned batch) {
+    struct io_uring ring;
+    struct io_uring_cqe* cqe;
+    unsigned head, seen;
+    long done = 0;
+
+    int res = io_uring_queue_init(URING_QUEUE_SIZE, &ring, 0);
+    if (res < 0) {
+        fprintf(stderr, "io_uring_queue_init failed: %s\n", strerror(-res));
+        return -1;
+    }
+
+    while (done < count) {
+        for (unsigned i = 0; i < batch; i++) {
+            io_uring_prep_nop(io_uring_get_sqe(&ring));
+        }
+
+        if (io_uring_submit_and_wait(&ring, batch) < 0) {
+            perror("io_uring_submit_and_wait error \n");
+            return -1;
+        }
+
+        seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            done += cqe->res == 0;
+            seen++;
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+
+    io_uring_queue_exit(&ring);
+    return done;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+    unsigned batches[MAX_BATCHES] = { 1, 8, 32, 128 };
+    int batch_count = 4;
+    long count = NOP_COUNT;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:b:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                count = strtol(optarg, NULL, 10);
+                if (count < 1) {
+                    fprintf(stderr, "NOP count must be > 0\n");
+                    return 1;
+                }
+                break;
+            case 'b': {
+                char* arg = optarg;
+                batch_count = 0;
+                while (*arg && batch_count < MAX_BATCHES) {
+                    batches[batch_count] = strtol(arg, &arg, 10);
+                    if (batches[batch_count] < 1 || batches[batch_count] > URING_QUEUE_SIZE) {
+                        fprintf(stderr, "Batch size must be > 0 and <= %i\n", URING_QUEUE_SIZE);
+                        return 1;
+                    }
+                    batch_count++;
+                    if (*arg == ',') {
+                        arg++;
+                    }
+                }
+                break;
+            }
+            case 'h':
+                printf("usage: %s [options]\n", argv[0]);
+                printf("      -n: NOPs per variant and batch size, defaults to %i \n", NOP_COUNT);
+                printf("      -b: SQEs submitted per io_uring_enter, a list like 1,8,32. defaults to 1,8,32,128 \n");
+                return 0;
+        }
+    }
+
+    const char* names[] = { "raw_ring", "fenced", "liburing" };
+    nop_loop loops[] = { raw_loop, fenced_loop, liburing_loop };
+
+    printf("NOP round trips, %li per run\n", count);
+
+    for (int b = 0; b < batch_count; b++) {
+        for (int v = 0; v < 3; v++) {
+            double start = now();
+            long done = loops[v](count, batches[b]);
+            double elapsed = now() - start;
+
+            if (done < 0) {
+                return 1;
+            }
+            printf("batch %4u  %-9s %8.2f Mops/s  %6.1f ns/op\n", batches[b], names[v],
+                   done / elapsed / 1e6, elapsed * 1e9 / done);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+#include "raw_ring.h"
+
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int sys_io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+
+int ring_init(struct raw_ring* ring, unsigned entries, struct io_uring_params* p)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = sys_io_uring_setup(entries, p);
+    if (ring->fd < 0) {
+        return -errno;
+    }
+
+    void* ptr;
+
+    //mapping submission queue
+    ring->sq_map_size = p->sq_off.array + p->sq_entries * sizeof(__u32);
+    ptr = mmap(0, ring->sq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        return -errno;
+    }
+    ring->sq_map = ptr;
+
+    //save for easier reference
+    ring->sq.head = ptr + p->sq_off.head;
+    ring->sq.tail = ptr + p->sq_off.tail;
+    ring->sq.ring_mask = ptr + p->sq_off.ring_mask;
+    ring->sq.ring_entries = ptr + p->sq_off.ring_entries;
+    ring->sq.flags = ptr + p->sq_off.flags;
+    ring->sq.array = ptr + p->sq_off.array;
+
+
+    //mapping submission queue entries
+    ring->sqes_map_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqes_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        return -errno;
+    }
+
+
+    //mapping completion queue
+    ring->cq_map_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    ptr = mmap(0, ring->cq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED) {
+        return -errno;
+    }
+    ring->cq_map = ptr;
+
+    //save for easier reference
+    ring->cq.head = ptr + p->cq_off.head;
+    ring->cq.tail = ptr + p->cq_off.tail;
+    ring->cq.ring_mask = ptr + p->cq_off.ring_mask;
+    ring->cq.ring_entries = ptr + p->cq_off.ring_entries;
+    ring->cq.cqes = ptr + p->cq_off.cqes;
+
+    ring->sqe_tail = *ring->sq.tail;
+
+    return 0;
+}
+
+void ring_exit(struct raw_ring* ring)
+{
+    if (ring->cq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
@@ -0,0 +1,132 @@
+#ifndef RAW_RING_H
+#define RAW_RING_H
+
+// io_uring straight on the syscalls and the mmap'd rings, no liburing. shared by the reader programs
+
+#include <linux/io_uring.h> //kernel 5.1 required
+
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+
+// the kernel pairs its ring updates with acquire/release, so do we. same as liburing/barrier.h:
+// on x86 both are plain accesses behind a compiler barrier, no fence instructions.
+// smp_mb() is the one full fence, for a load that must not pass an earlier store (SQ tail, then SQ flags).
+// cpu_relax() goes in every spin on the rings, the pause hint keeps a spinning core off the sibling hyperthread
+#if defined(__x86_64__)
+#define ring_barrier() __asm__ __volatile__("":::"memory")
+#define smp_store_release(p, v) do { ring_barrier(); *(volatile __typeof(*(p))*)(p) = (v); } while (0)
+#define smp_load_acquire(p) ({ __typeof(*(p)) ___v = *(volatile __typeof(*(p))*)(p); ring_barrier(); ___v; })
+#define smp_mb() __asm__ __volatile__("lock; addl $0,-128(%%rsp)":::"memory")
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+
+struct app_sq_ring {
+    unsigned* head;
+    unsigned* tail;
+    unsigned* ring_mask;
+    unsigned* ring_entries;
+    unsigned* flags;
+    unsigned* array;
+};
+
+struct app_cq_ring {
+    unsigned* head;
+    unsigned* tail;
+    unsigned* ring_mask;
+    unsigned* ring_entries;
+    struct io_uring_cqe* cqes;
+};
+
+struct raw_ring {
+    int fd;
+    struct app_sq_ring sq;
+    struct app_cq_ring cq;
+    struct io_uring_sqe* sqes;
+    unsigned sqe_tail;          // SQEs filled up to here, the kernel sees them after ring_flush()
+
+    void* sq_map;               // the three mappings as returned by mmap, for ring_exit()
+    void* cq_map;
+    size_t sq_map_size;
+    size_t sqes_map_size;
+    size_t cq_map_size;
+};
+
+
+// these are not in the linux c library yet
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *p);
+int sys_io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags);
+int sys_io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args);
+
+// sets up the ring and maps SQ, SQEs and CQ. p may carry setup flags, returns 0 or -errno
+int ring_init(struct raw_ring* ring, unsigned entries, struct io_uring_params* p);
+
+// unmaps whatever ring_init() mapped and closes the ring fd, also after a failed ring_init()
+void ring_exit(struct raw_ring* ring);
+
+
+// next free SQE, zeroed, NULL if the SQ is full
+static inline struct io_uring_sqe* ring_get_sqe(struct raw_ring* ring)
+{
+    unsigned head = smp_load_acquire(ring->sq.head);
+
+    if (ring->sqe_tail - head >= *ring->sq.ring_entries) {
+        return NULL;
+    }
+
+    unsigned index = ring->sqe_tail & *ring->sq.ring_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    __builtin_memset(sqe, 0, sizeof(*sqe));
+    ring->sq.array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// publishes every SQE filled since the last flush with one tail store, returns how many
+static inline unsigned ring_flush(struct raw_ring* ring)
+{
+    unsigned tail = *ring->sq.tail;
+
+    if (tail != ring->sqe_tail) {
+        smp_store_release(ring->sq.tail, ring->sqe_tail);
+    }
+    return ring->sqe_tail - tail;
+}
+
+// SQPOLL: after a flush, whether the poller went idle and needs IORING_ENTER_SQ_WAKEUP to see it.
+// the fence keeps the flags load behind the tail store, the poller checks the tail after setting the flag
+static inline int ring_sq_needs_wakeup(struct raw_ring* ring)
+{
+    smp_mb();
+    return *(volatile unsigned*)ring->sq.flags & IORING_SQ_NEED_WAKEUP;
+}
+
+// CQEs are walked from head up to the tail loaded once, then released together by ring_cq_advance()
+static inline unsigned ring_cq_head(struct raw_ring* ring)
+{
+    return *ring->cq.head;
+}
+
+static inline unsigned ring_cq_tail(struct raw_ring* ring)
+{
+    return smp_load_acquire(ring->cq.tail);
+}
+
+static inline struct io_uring_cqe* ring_cqe_at(struct raw_ring* ring, unsigned head)
+{
+    return &ring->cq.cqes[head & *ring->cq.ring_mask];
+}
+
+static inline void ring_cq_advance(struct raw_ring* ring, unsigned head)
+{
+    smp_store_release(ring->cq.head, head);
+}
+
+#endif
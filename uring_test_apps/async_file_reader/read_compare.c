@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define SET_SIZE_MB 64          // default bytes per generated file set
+#define CHUNK_SIZE_KB 1024      // default read size
+#define POOL_THREADS 4          // default pread threads
+#define QUEUE_DEPTH 32          // default io_uring depth
+#define MAX_SIZES 16
+#define MAX_STRATEGIES 16
+#define PAGE_SIZE 4096
+
+// the same file set is read with every strategy, each in a child of its own so CPU time and peak RSS
+// come from wait4(). in-process strategies run in a forked child, the io_uring readers are run as they are
+
+struct file_set {
+    char** names;
+    int count;
+    off_t bytes;
+};
+
+// reads every file of the set, returns 0 or 1
+typedef int (*read_strategy)(struct file_set* set);
+
+struct strategy {
+    const char* name;
+    read_strategy run;          // in-process
+    const char* reader;         // or a reader program next to this one
+    const char* option;         // its extra option, if any
+    int chunked;                // takes -c
+};
+
+
+unsigned chunk_size = CHUNK_SIZE_KB * 1024;
+unsigned pool_threads = POOL_THREADS;
+unsigned depth = QUEUE_DEPTH;
+char reader_dir[PATH_MAX];
+
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+// one thread, read() in chunks
+int read_files(struct file_set* set) {
+    char* buffer = malloc(chunk_size);
+    off_t total = 0;
+
+    for (int i = 0; i < set->count; i++) {
+        int fd = open(set->names[i], O_RDONLY);
+        ssize_t res;
+
+        if (fd < 0) {
+            fprintf(stderr, "open error: %s, file %s\n", strerror(errno), set->names[i]);
+            return 1;
+        }
+        while ((res = read(fd, buffer, chunk_size)) > 0) {
+            total += res;
+        }
+        close(fd);
+
+        if (res < 0) {
+            fprintf(stderr, "read error: %s, file %s\n", strerror(errno), set->names[i]);
+            return 1;
+        }
+    }
+    return total != set->bytes;
+}
+
+
+// pread thread pool: the files are opened up front, the threads take chunks off a shared counter
+struct pool_unit {
+    int fd;
+    off_t offset;
+};
+
+struct pool_unit* units;
+unsigned long unit_count;
+unsigned long next_unit;
+off_t pool_bytes;
+
+void* pool_worker(void* arg) {
+    char* buffer = malloc(chunk_size);
+    off_t total = 0;
+    unsigned long u;
+
+    while ((u = __atomic_fetch_add(&next_unit, 1, __ATOMIC_RELAXED)) < unit_count) {
+        ssize_t res = pread(units[u].fd, buffer, chunk_size, units[u].offset);
+
+        if (res < 0) {
+            perror("pread error");
+            break;
+        }
+        total += res;
+    }
+
+    __atomic_fetch_add(&pool_bytes, total, __ATOMIC_RELAXED);
+    free(buffer);
+    return NULL;
+}
+
+int pread_pool(struct file_set* set) {
+    int* fds = malloc(sizeof(int) * set->count);
+    pthread_t threads[pool_threads];
+
+    unit_count = 0;
+    units = malloc(sizeof(struct pool_unit) * (set->bytes / chunk_size + set->count));
+
+    for (int i = 0; i < set->count; i++) {
+        struct stat st;
+
+        fds[i] = open(set->names[i], O_RDONLY);
+        if (fds[i] < 0) {
+            fprintf(stderr, "open error: %s, file %s\n", strerror(errno), set->names[i]);
+            return 1;
+        }
+        fstat(fds[i], &st);
+        for (off_t offset = 0; offset < st.st_size; offset += chunk_size) {
+            units[unit_count].fd = fds[i];
+            units[unit_count].offset = offset;
+            unit_count++;
+        }
+    }
+
+    for (unsigned t = 0; t < pool_threads; t++) {
+        pthread_create(&threads[t], NULL, pool_worker, NULL);
+    }
+    for (unsigned t = 0; t < pool_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        close(fds[i]);
+    }
+    return pool_bytes != set->bytes;
+}
+
+
+// mmap with MADV_SEQUENTIAL, one byte read per page faults it in. the mapped pages count in the RSS
+int mmap_files(struct file_set* set) {
+    volatile unsigned char sum = 0;
+    off_t total = 0;
+
+    for (int i = 0; i < set->count; i++) {
+        struct stat st;
+        int fd = open(set->names[i], O_RDONLY);
+
+        if (fd < 0) {
+            fprintf(stderr, "open error: %s, file %s\n", strerror(errno), set->names[i]);
+            return 1;
+        }
+        fstat(fd, &st);
+
+        if (st.st_size) {
+            unsigned char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data == MAP_FAILED) {
+                fprintf(stderr, "mmap error: %s, file %s\n", strerror(errno), set->names[i]);
+                return 1;
+            }
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+            for (off_t offset = 0; offset < st.st_size; offset += PAGE_SIZE) {
+                sum += data[offset];
+            }
+            munmap(data, st.st_size);
+            total += st.st_size;
+        }
+        close(fd);
+    }
+    return total != set->bytes;
+}
+
+
+struct strategy strategies[] = {
+    { "read",          read_files, NULL, NULL, 0 },
+    { "pread-pool",    pread_pool, NULL, NULL, 0 },
+    { "mmap",          mmap_files, NULL, NULL, 0 },
+    { "uring",         NULL, "1_uring_read", NULL, 1 },
+    { "uring-fixed",   NULL, "1_uring_read", "-B", 1 },
+    { "uring-chains",  NULL, "1_uring_read", "-s", 1 },
+    { "uring-sqpoll",  NULL, "2_uring_read_SQPOLL", NULL, 0 },
+};
+#define STRATEGY_COUNT (int)(sizeof(strategies) / sizeof(strategies[0]))
+
+
+
+// cold: the set's pages are dropped with fadvise, they're clean since the set was synced. warm: read once
+void prepare_cache(struct file_set* set, int warm) {
+    if (warm) {
+        read_files(set);
+        return;
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        int fd = open(set->names[i], O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+void exec_reader(struct strategy* s, struct file_set* set) {
+    char path[PATH_MAX + 64], depth_arg[16], chunk_arg[16];
+    char** argv = malloc(sizeof(char*) * (set->count + 10));
+    int argc = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", reader_dir, s->reader);
+    snprintf(depth_arg, sizeof(depth_arg), "%u", depth);
+    snprintf(chunk_arg, sizeof(chunk_arg), "%u", chunk_size / 1024);
+
+    argv[argc++] = path;
+    argv[argc++] = "-Q";
+    argv[argc++] = "-q";
+    argv[argc++] = depth_arg;
+    if (s->chunked) {
+        argv[argc++] = "-c";
+        argv[argc++] = chunk_arg;
+    }
+    if (s->option) {
+        argv[argc++] = (char*) s->option;
+    }
+    for (int i = 0; i < set->count; i++) {
+        argv[argc++] = set->names[i];
+    }
+    argv[argc] = NULL;
+
+    // only the numbers here count, the reader's own report goes
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+
+    execv(path, argv);
+    fprintf(stderr, "exec error: %s, %s\n", strerror(errno), path);
+    exit(1);
+}
+
+void run_strategy(struct strategy* s, struct file_set* set, int warm) {
+    struct rusage ru;
+    int status;
+
+    prepare_cache(set, warm);
+    fflush(stdout);
+
+    double start = now_seconds();
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        if (s->run) {
+            exit(s->run(set));
+        }
+        exec_reader(s, set);
+    }
+
+    if (pid < 0 || wait4(pid, &status, 0, &ru) < 0) {
+        perror("fork failed");
+        exit(1);
+    }
+    double elapsed = now_seconds() - start;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("%-14s %-5s failed\n", s->name, warm ? "warm" : "cold");
+        return;
+    }
+
+    double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+    printf("%-14s %-5s %9.1f MB/s %9.0f files/s %7.3f cpu s %8.1f MiB rss\n", s->name, warm ? "warm" : "cold",
+           set->bytes / elapsed / 1e6, set->count / elapsed, cpu, ru.ru_maxrss / 1024.0);
+}
+
+
+
+// dir/<size>k/<n>, kept from earlier runs when the last file is there with the right size
+int generate_set(struct file_set* set, const char* dir, unsigned size_kb, unsigned set_mb) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    set->count = set_mb * 1024 / size_kb ? set_mb * 1024 / size_kb : 1;
+    set->bytes = (off_t)set->count * size_kb * 1024;
+    set->names = malloc(sizeof(char*) * set->count);
+
+    snprintf(path, sizeof(path), "%s/%uk", dir, size_kb);
+    mkdir(dir, 0755);
+    mkdir(path, 0755);
+
+    for (int i = 0; i < set->count; i++) {
+        snprintf(path, sizeof(path), "%s/%uk/%06i", dir, size_kb, i);
+        set->names[i] = strdup(path);
+    }
+
+    if (stat(set->names[set->count - 1], &st) == 0 && st.st_size == (off_t)size_kb * 1024) {
+        return 0;
+    }
+
+    printf("Writing %i files of %u KiB to %s/%uk\n", set->count, size_kb, dir, size_kb);
+
+    size_t len = (size_t)size_kb * 1024;
+    uint64_t* data = malloc(len);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    for (size_t w = 0; w < len / 8; w++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[w] = x;
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        int fd = open(set->names[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        // a different first word per file keeps the set from deduplicating
+        data[0] = i;
+        if (fd < 0 || write(fd, data, len) != (ssize_t)len) {
+            fprintf(stderr, "write error: %s, file %s\n", strerror(errno), set->names[i]);
+            return 1;
+        }
+        close(fd);
+    }
+
+    // fadvise only drops clean pages
+    int fd = open(dir, O_RDONLY);
+    syncfs(fd);
+    close(fd);
+
+    free(data);
+    return 0;
+}
+
+void run_set(struct file_set* set, const char* label, int* selected, int cold, int warm) {
+    printf("--- %s: %i files, %.1f MiB\n", label, set->count, set->bytes / 1048576.0);
+
+    for (int pass = 0; pass < 2; pass++) {
+        if ((pass == 0 && !cold) || (pass == 1 && !warm)) {
+            continue;
+        }
+        for (int s = 0; s < STRATEGY_COUNT; s++) {
+            if (selected[s]) {
+                run_strategy(&strategies[s], set, pass);
+            }
+        }
+    }
+    printf("\n");
+}
+
+// the readers and the pool keep many files open at once
+void raise_file_limit() {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+    unsigned sizes[MAX_SIZES] = { 4, 64, 1024, 65536 };
+    int size_count = 4;
+    unsigned set_mb = SET_SIZE_MB;
+    char* dir = "./read_compare_data";
+    int selected[MAX_STRATEGIES];
+    int cold = 1, warm = 1;
+    int opt;
+
+    for (int s = 0; s < STRATEGY_COUNT; s++) {
+        selected[s] = 1;
+    }
+
+    while((opt = getopt(argc, argv, "f:m:d:c:t:q:s:CWh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'f': {
+                char* arg = optarg;
+                size_count = 0;
+                while (*arg && size_count < MAX_SIZES) {
+                    sizes[size_count] = strtol(arg, &arg, 10);
+                    if (sizes[size_count] < 1) {
+                        fprintf(stderr, "File sizes must be > 0 KiB\n");
+                        return 1;
+                    }
+                    size_count++;
+                    if (*arg == ',') {
+                        arg++;
+                    }
+                }
+                break;
+            }
+            case 'm':
+                set_mb = strtol(optarg, NULL, 10);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'c':
+                chunk_size = strtol(optarg, NULL, 10) * 1024;
+                if (chunk_size == 0) {
+                    fprintf(stderr, "Chunk size must be > 0 KiB\n");
+                    return 1;
+                }
+                break;
+            case 't':
+                pool_threads = strtol(optarg, NULL, 10);
+                if (pool_threads < 1 || pool_threads > 256) {
+                    fprintf(stderr, "Pool threads must be > 0 and <= 256\n");
+                    return 1;
+                }
+                break;
+            case 'q':
+                depth = strtol(optarg, NULL, 10);
+                break;
+            case 's': {
+                char* name = strtok(optarg, ",");
+                memset(selected, 0, sizeof(selected));
+                while (name) {
+                    int s;
+                    for (s = 0; s < STRATEGY_COUNT && strcmp(strategies[s].name, name); s++);
+                    if (s == STRATEGY_COUNT) {
+                        fprintf(stderr, "Unknown strategy %s\n", name);
+                        return 1;
+                    }
+                    selected[s] = 1;
+                    name = strtok(NULL, ",");
+                }
+                break;
+            }
+            case 'C':
+                warm = 0;
+                break;
+            case 'W':
+                cold = 0;
+                break;
+            case 'h':
+                printf("usage: %s [options] [file...]\n", argv[0]);
+                printf("      reads one file set with each strategy, cold and warm, and reports throughput, CPU and peak RSS. \n");
+                printf("      without files, a set is generated for every file size \n");
+                printf("      -f: file sizes in KiB, a list like 4,64,1024. defaults to 4,64,1024,65536 \n");
+                printf("      -m: MiB per generated set, defaults to %i \n", SET_SIZE_MB);
+                printf("      -d: directory for the generated sets, defaults to ./read_compare_data \n");
+                printf("      -c: read size in KiB for read, pread and the chunked io_uring reader. defaults to %i \n", CHUNK_SIZE_KB);
+                printf("      -t: pread pool threads, defaults to %i \n", POOL_THREADS);
+                printf("      -q: io_uring queue depth, defaults to %i \n", QUEUE_DEPTH);
+                printf("      -s: strategies, a list like read,mmap,uring. defaults to all of: ");
+                for (int s = 0; s < STRATEGY_COUNT; s++) {
+                    printf("%s%s", strategies[s].name, s + 1 < STRATEGY_COUNT ? "," : " \n");
+                }
+                printf("      -C: cold cache only, the set is dropped with POSIX_FADV_DONTNEED before each run \n");
+                printf("      -W: warm cache only, the set is read once before each run \n");
+                return 0;
+        }
+    }
+
+    // the readers are looked up next to this program
+    ssize_t len = readlink("/proc/self/exe", reader_dir, sizeof(reader_dir) - 1);
+    if (len < 0) {
+        perror("readlink /proc/self/exe failed");
+        return 1;
+    }
+    reader_dir[len] = '\0';
+    *strrchr(reader_dir, '/') = '\0';
+
+    raise_file_limit();
+
+    printf("%u KiB reads, %u pread threads, io_uring depth %u\n\n", chunk_size / 1024, pool_threads, depth);
+
+    if (optind < argc) {
+        struct file_set set = { &argv[optind], argc - optind, 0 };
+        struct stat st;
+
+        for (int i = 0; i < set.count; i++) {
+            if (stat(set.names[i], &st) < 0) {
+                fprintf(stderr, "stat error: %s, file %s\n", strerror(errno), set.names[i]);
+                return 1;
+            }
+            set.bytes += st.st_size;
+        }
+        run_set(&set, "given files", selected, cold, warm);
+        return 0;
+    }
+
+    for (int i = 0; i < size_count; i++) {
+        struct file_set set;
+        char label[64];
+
+        if (generate_set(&set, dir, sizes[i], set_mb)) {
+            return 1;
+        }
+        snprintf(label, sizeof(label), "%u KiB files", sizes[i]);
+        run_set(&set, label, selected, cold, warm);
+
+        for (int f = 0; f < set.count; f++) {
+            free(set.names[f]);
+        }
+        free(set.names);
+    }
+
+    return 0;
+}
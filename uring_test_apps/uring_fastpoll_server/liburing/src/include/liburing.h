@@ -2,6 +2,10 @@
 #ifndef LIB_URING_H
 #define LIB_URING_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* Required for cpu_set_t */
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,6 +18,7 @@ extern "C" {
 #include <stdbool.h>
 #include <inttypes.h>
 #include <time.h>
+#include <sched.h>
 #include "liburing/compat.h"
 #include "liburing/io_uring.h"
 #include "liburing/barrier.h"
@@ -56,6 +61,10 @@ struct io_uring {
 	struct io_uring_cq cq;
 	unsigned flags;
 	int ring_fd;
+
+	unsigned features;
+	int enter_ring_fd;
+	__u8 int_flags;
 };
 
 /*
@@ -94,6 +103,9 @@ extern int io_uring_wait_cqe_timeout(struct io_uring *ring,
 	struct io_uring_cqe **cqe_ptr, struct __kernel_timespec *ts);
 extern int io_uring_submit(struct io_uring *ring);
 extern int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr);
+extern int io_uring_submit_and_wait_timeout(struct io_uring *ring,
+	struct io_uring_cqe **cqe_ptr, unsigned wait_nr,
+	struct __kernel_timespec *ts, sigset_t *sigmask);
 extern struct io_uring_sqe *io_uring_get_sqe(struct io_uring *ring);
 
 extern int io_uring_register_buffers(struct io_uring *ring,
@@ -112,6 +124,24 @@ extern int io_uring_register_probe(struct io_uring *ring,
 					struct io_uring_probe *p, unsigned nr);
 extern int io_uring_register_personality(struct io_uring *ring);
 extern int io_uring_unregister_personality(struct io_uring *ring, int id);
+extern int io_uring_register_ring_fd(struct io_uring *ring);
+extern int io_uring_unregister_ring_fd(struct io_uring *ring);
+extern int io_uring_register_files_sparse(struct io_uring *ring, unsigned nr);
+extern int io_uring_register_buf_ring(struct io_uring *ring,
+				      struct io_uring_buf_reg *reg,
+				      unsigned int flags);
+extern int io_uring_unregister_buf_ring(struct io_uring *ring, int bgid);
+extern int io_uring_register_iowq_aff(struct io_uring *ring, size_t cpusz,
+				      const cpu_set_t *mask);
+extern int io_uring_unregister_iowq_aff(struct io_uring *ring);
+extern int io_uring_register_iowq_max_workers(struct io_uring *ring,
+					      unsigned int *values);
+
+/*
+ * Raw io_uring_register(2), for opcodes without a dedicated helper
+ */
+extern int io_uring_register(unsigned int fd, unsigned int opcode,
+			     const void *arg, unsigned int nr_args);
 
 /*
  * Helper for the peek/wait single cqe functions. Exported because of that,
@@ -245,6 +275,85 @@ static inline void io_uring_prep_recvmsg(struct io_uring_sqe *sqe, int fd,
 	sqe->msg_flags = flags;
 }
 
+static inline void io_uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe,
+						   int fd, struct msghdr *msg,
+						   unsigned flags)
+{
+	io_uring_prep_recvmsg(sqe, fd, msg, flags);
+	sqe->ioprio |= IORING_RECV_MULTISHOT;
+}
+
+/*
+ * Helpers to walk the buffer a multishot recvmsg completion points to. 'msgh'
+ * is the msghdr the request was prepared with, its msg_namelen and
+ * msg_controllen give the size of the fixed regions in front of the payload.
+ */
+static inline struct io_uring_recvmsg_out *
+io_uring_recvmsg_validate(void *buf, int buf_len, struct msghdr *msgh)
+{
+	unsigned long header = msgh->msg_controllen + msgh->msg_namelen +
+				sizeof(struct io_uring_recvmsg_out);
+
+	if (buf_len < 0 || (unsigned long) buf_len < header)
+		return NULL;
+	return (struct io_uring_recvmsg_out *) buf;
+}
+
+static inline void *io_uring_recvmsg_name(struct io_uring_recvmsg_out *o)
+{
+	return (void *) &o[1];
+}
+
+static inline struct cmsghdr *
+io_uring_recvmsg_cmsg_firsthdr(struct io_uring_recvmsg_out *o,
+			       struct msghdr *msgh)
+{
+	if (o->controllen < sizeof(struct cmsghdr))
+		return NULL;
+
+	return (struct cmsghdr *)((unsigned char *) io_uring_recvmsg_name(o) +
+			msgh->msg_namelen);
+}
+
+static inline struct cmsghdr *
+io_uring_recvmsg_cmsg_nexthdr(struct io_uring_recvmsg_out *o,
+			      struct msghdr *msgh, struct cmsghdr *cmsg)
+{
+	unsigned char *end;
+
+	if (cmsg->cmsg_len < sizeof(struct cmsghdr))
+		return NULL;
+	end = (unsigned char *) io_uring_recvmsg_cmsg_firsthdr(o, msgh) +
+		o->controllen;
+	cmsg = (struct cmsghdr *)((unsigned char *) cmsg +
+			CMSG_ALIGN(cmsg->cmsg_len));
+
+	if ((unsigned char *) (cmsg + 1) > end)
+		return NULL;
+	if (((unsigned char *) cmsg) + CMSG_ALIGN(cmsg->cmsg_len) > end)
+		return NULL;
+
+	return cmsg;
+}
+
+static inline void *io_uring_recvmsg_payload(struct io_uring_recvmsg_out *o,
+					     struct msghdr *msgh)
+{
+	return (void *)((unsigned char *) io_uring_recvmsg_name(o) +
+			msgh->msg_namelen + msgh->msg_controllen);
+}
+
+static inline unsigned int
+io_uring_recvmsg_payload_length(struct io_uring_recvmsg_out *o,
+				int buf_len, struct msghdr *msgh)
+{
+	unsigned long payload_start, payload_end;
+
+	payload_start = (unsigned long) io_uring_recvmsg_payload(o, msgh);
+	payload_end = (unsigned long) o + buf_len;
+	return (unsigned int) (payload_end - payload_start);
+}
+
 static inline void io_uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd,
 					 const struct msghdr *msg, unsigned flags)
 {
@@ -302,6 +411,18 @@ static inline void io_uring_prep_accept(struct io_uring_sqe *sqe, int fd,
 	sqe->accept_flags = flags;
 }
 
+/*
+ * Accept stays armed and posts one CQE per connection, IORING_CQE_F_MORE is
+ * cleared on the last one.
+ */
+static inline void io_uring_prep_multishot_accept(struct io_uring_sqe *sqe,
+						  int fd, struct sockaddr *addr,
+						  socklen_t *addrlen, int flags)
+{
+	io_uring_prep_accept(sqe, fd, addr, addrlen, flags);
+	sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+
 static inline void io_uring_prep_cancel(struct io_uring_sqe *sqe, void *user_data,
 					int flags)
 {
@@ -351,6 +472,18 @@ static inline void io_uring_prep_close(struct io_uring_sqe *sqe, int fd)
 	io_uring_prep_rw(IORING_OP_CLOSE, sqe, fd, NULL, 0, 0);
 }
 
+/*
+ * Posts a CQE with res = len and user_data = data to the ring behind fd, the
+ * sending ring gets its own CQE with the result.
+ */
+static inline void io_uring_prep_msg_ring(struct io_uring_sqe *sqe, int fd,
+					  unsigned int len, __u64 data,
+					  unsigned int flags)
+{
+	io_uring_prep_rw(IORING_OP_MSG_RING, sqe, fd, NULL, len, data);
+	sqe->msg_ring_flags = flags;
+}
+
 static inline void io_uring_prep_read(struct io_uring_sqe *sqe, int fd,
 				      void *buf, unsigned nbytes, off_t offset)
 {
@@ -394,6 +527,30 @@ static inline void io_uring_prep_send(struct io_uring_sqe *sqe, int sockfd,
 	sqe->msg_flags = flags;
 }
 
+/*
+ * Zero-copy send. Posts the send result with IORING_CQE_F_MORE set, then a
+ * second IORING_CQE_F_NOTIF CQE once the kernel no longer references buf.
+ */
+static inline void io_uring_prep_send_zc(struct io_uring_sqe *sqe, int sockfd,
+					 const void *buf, size_t len, int flags,
+					 unsigned zc_flags)
+{
+	io_uring_prep_rw(IORING_OP_SEND_ZC, sqe, sockfd, buf, len, 0);
+	sqe->msg_flags = flags;
+	sqe->ioprio = zc_flags;
+}
+
+static inline void io_uring_prep_send_zc_fixed(struct io_uring_sqe *sqe,
+					       int sockfd, const void *buf,
+					       size_t len, int flags,
+					       unsigned zc_flags,
+					       unsigned buf_index)
+{
+	io_uring_prep_send_zc(sqe, sockfd, buf, len, flags, zc_flags);
+	sqe->ioprio |= IORING_RECVSEND_FIXED_BUF;
+	sqe->buf_index = buf_index;
+}
+
 static inline void io_uring_prep_recv(struct io_uring_sqe *sqe, int sockfd,
 				      void *buf, size_t len, int flags)
 {
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef LIBURING_INT_FLAGS
+#define LIBURING_INT_FLAGS
+
+/*
+ * Library private flags kept in io_uring->int_flags
+ */
+enum {
+	INT_FLAG_REG_RING	= 1,	/* ring fd registered, enter by index */
+};
+
+#endif
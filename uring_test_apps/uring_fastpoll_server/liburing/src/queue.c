@@ -13,6 +13,7 @@
 #include "liburing/barrier.h"
 
 #include "syscall.h"
+#include "int_flags.h"
 
 /*
  * Returns true if we're not using SQ thread (thus nobody submits but us)
@@ -59,10 +60,21 @@ static int __io_uring_peek_cqe(struct io_uring *ring,
 	return err;
 }
 
-int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
-		       unsigned submit, unsigned wait_nr, sigset_t *sigmask)
+struct get_data {
+	unsigned submit;
+	unsigned wait_nr;
+	unsigned get_flags;
+	int sz;
+	void *arg;
+};
+
+static int _io_uring_get_cqe(struct io_uring *ring,
+			     struct io_uring_cqe **cqe_ptr,
+			     struct get_data *data)
 {
 	struct io_uring_cqe *cqe = NULL;
+	unsigned submit = data->submit;
+	unsigned wait_nr = data->wait_nr;
 	const int to_wait = wait_nr;
 	int ret = 0, err;
 
@@ -79,12 +91,15 @@ int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
 		if (wait_nr && cqe)
 			wait_nr--;
 		if (wait_nr)
-			flags = IORING_ENTER_GETEVENTS;
+			flags = IORING_ENTER_GETEVENTS | data->get_flags;
 		if (submit)
 			sq_ring_needs_enter(ring, submit, &flags);
+		if (ring->int_flags & INT_FLAG_REG_RING)
+			flags |= IORING_ENTER_REGISTERED_RING;
 		if (wait_nr || submit)
-			ret = __sys_io_uring_enter(ring->ring_fd, submit,
-						   wait_nr, flags, sigmask);
+			ret = __sys_io_uring_enter2(ring->enter_ring_fd, submit,
+						    wait_nr, flags, data->arg,
+						    data->sz);
 		if (ret < 0) {
 			err = -errno;
 		} else if (ret == (int)submit) {
@@ -100,6 +115,20 @@ int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
 		} else {
 			submit -= ret;
 		}
+
+		/*
+		 * A wait bounded by an extended argument timeout is over after
+		 * a single io_uring_enter(2), whether it timed out or not. Any
+		 * completion that arrived in the meantime is returned, -ETIME
+		 * only if there is none.
+		 */
+		if ((flags & IORING_ENTER_EXT_ARG) && (!err || err == -ETIME)) {
+			if (!cqe)
+				__io_uring_peek_cqe(ring, &cqe);
+			err = cqe ? 0 : -ETIME;
+			break;
+		}
+
 		if (cqe)
 			break;
 	} while (!err);
@@ -108,6 +137,20 @@ int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
 	return err;
 }
 
+int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+		       unsigned submit, unsigned wait_nr, sigset_t *sigmask)
+{
+	struct get_data data = {
+		.submit		= submit,
+		.wait_nr	= wait_nr,
+		.get_flags	= 0,
+		.sz		= _NSIG / 8,
+		.arg		= sigmask,
+	};
+
+	return _io_uring_get_cqe(ring, cqe_ptr, &data);
+}
+
 /*
  * Fill in an array of IO completions up to count, if any are available.
  * Returns the amount of IO completions filled.
@@ -171,9 +214,38 @@ out:
 }
 
 /*
- * Like io_uring_wait_cqe(), except it accepts a timeout value as well. Note
- * that an sqe is used internally to handle the timeout. Applications using
- * this function must never set sqe->user_data to LIBURING_UDATA_TIMEOUT!
+ * Wait using IORING_ENTER_EXT_ARG: the timeout travels with the enter call
+ * instead of being queued as a timeout sqe, so no extra completion is posted
+ * and nothing has to be filtered out of the CQ ring.
+ */
+static int io_uring_wait_cqes_new(struct io_uring *ring,
+				  struct io_uring_cqe **cqe_ptr,
+				  unsigned wait_nr, unsigned submit,
+				  struct __kernel_timespec *ts,
+				  sigset_t *sigmask)
+{
+	struct io_uring_getevents_arg arg = {
+		.sigmask	= (unsigned long) sigmask,
+		.sigmask_sz	= _NSIG / 8,
+		.ts		= (unsigned long) ts
+	};
+	struct get_data data = {
+		.submit		= submit,
+		.wait_nr	= wait_nr,
+		.get_flags	= IORING_ENTER_EXT_ARG,
+		.sz		= sizeof(arg),
+		.arg		= &arg
+	};
+
+	return _io_uring_get_cqe(ring, cqe_ptr, &data);
+}
+
+/*
+ * Like io_uring_wait_cqe(), except it accepts a timeout value as well. On
+ * kernels with IORING_FEAT_EXT_ARG the timeout is passed to io_uring_enter(2)
+ * directly. On older kernels an sqe is used internally to handle the timeout.
+ * Applications using this function must never set sqe->user_data to
+ * LIBURING_UDATA_TIMEOUT!
  *
  * If 'ts' is specified, the application need not call io_uring_submit() before
  * calling this function, as we will do that on its behalf. From this it also
@@ -187,6 +259,11 @@ int io_uring_wait_cqes(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
 {
 	unsigned to_submit = 0;
 
+	if (ts && (ring->features & IORING_FEAT_EXT_ARG))
+		return io_uring_wait_cqes_new(ring, cqe_ptr, wait_nr,
+					      __io_uring_flush_sq(ring), ts,
+					      sigmask);
+
 	if (ts) {
 		struct io_uring_sqe *sqe;
 		int ret;
@@ -211,6 +288,35 @@ int io_uring_wait_cqes(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
 	return __io_uring_get_cqe(ring, cqe_ptr, to_submit, wait_nr, sigmask);
 }
 
+/*
+ * Submit pending sqes and wait for 'wait_nr' completions or until 'ts'
+ * expires, whichever comes first, in a single io_uring_enter(2). Requires
+ * IORING_FEAT_EXT_ARG, -EINVAL is returned on older kernels.
+ *
+ * Returns number of sqes submitted or -errno. A timeout with no completion
+ * available returns -ETIME.
+ */
+int io_uring_submit_and_wait_timeout(struct io_uring *ring,
+				     struct io_uring_cqe **cqe_ptr,
+				     unsigned wait_nr,
+				     struct __kernel_timespec *ts,
+				     sigset_t *sigmask)
+{
+	unsigned to_submit;
+	int ret;
+
+	if (!(ring->features & IORING_FEAT_EXT_ARG))
+		return -EINVAL;
+
+	to_submit = __io_uring_flush_sq(ring);
+	ret = io_uring_wait_cqes_new(ring, cqe_ptr, wait_nr, to_submit, ts,
+				     sigmask);
+	if (ret < 0)
+		return ret;
+
+	return to_submit;
+}
+
 /*
  * See io_uring_wait_cqes() - this function is the same, it just always uses
  * '1' as the wait_nr.
@@ -237,9 +343,11 @@ static int __io_uring_submit(struct io_uring *ring, unsigned submitted,
 	if (sq_ring_needs_enter(ring, submitted, &flags) || wait_nr) {
 		if (wait_nr || (ring->flags & IORING_SETUP_IOPOLL))
 			flags |= IORING_ENTER_GETEVENTS;
+		if (ring->int_flags & INT_FLAG_REG_RING)
+			flags |= IORING_ENTER_REGISTERED_RING;
 
-		ret = __sys_io_uring_enter(ring->ring_fd, submitted, wait_nr,
-						flags, NULL);
+		ret = __sys_io_uring_enter(ring->enter_ring_fd, submitted,
+						wait_nr, flags, NULL);
 		if (ret < 0)
 			return -errno;
 	} else
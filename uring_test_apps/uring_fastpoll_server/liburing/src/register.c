@@ -11,6 +11,7 @@
 #include "liburing.h"
 
 #include "syscall.h"
+#include "int_flags.h"
 
 int io_uring_register_buffers(struct io_uring *ring, const struct iovec *iovecs,
 			      unsigned nr_iovecs)
@@ -159,3 +160,139 @@ int io_uring_unregister_personality(struct io_uring *ring, int id)
 
 	return ret;
 }
+
+/*
+ * Register the ring fd with the submitting task. io_uring_enter(2) is then
+ * passed the registered index instead of the fd, which skips the fd table
+ * lookup and reference counting on every call. The registration belongs to
+ * the task that made it, other threads keep using the normal fd.
+ *
+ * Returns 1 on success, -errno on failure.
+ */
+int io_uring_register_ring_fd(struct io_uring *ring)
+{
+	struct io_uring_rsrc_update up = {
+		.data = ring->ring_fd,
+		.offset = -1U,
+	};
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd, IORING_REGISTER_RING_FDS,
+					&up, 1);
+	if (ret < 0)
+		return -errno;
+
+	if (ret == 1) {
+		ring->enter_ring_fd = up.offset;
+		ring->int_flags |= INT_FLAG_REG_RING;
+	}
+	return ret;
+}
+
+int io_uring_unregister_ring_fd(struct io_uring *ring)
+{
+	struct io_uring_rsrc_update up = {
+		.offset = ring->enter_ring_fd,
+	};
+	int ret;
+
+	if (!(ring->int_flags & INT_FLAG_REG_RING))
+		return -EINVAL;
+
+	ret = __sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_RING_FDS,
+					&up, 1);
+	if (ret < 0)
+		return -errno;
+
+	if (ret == 1) {
+		ring->enter_ring_fd = ring->ring_fd;
+		ring->int_flags &= ~INT_FLAG_REG_RING;
+	}
+	return ret;
+}
+
+int io_uring_register_files_sparse(struct io_uring *ring, unsigned nr)
+{
+	struct io_uring_rsrc_register reg = {
+		.flags = IORING_RSRC_REGISTER_SPARSE,
+		.nr = nr,
+	};
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES2,
+					&reg, sizeof(reg));
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+int io_uring_register_buf_ring(struct io_uring *ring,
+			       struct io_uring_buf_reg *reg,
+			       unsigned int flags)
+{
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING,
+					reg, 1);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+int io_uring_unregister_buf_ring(struct io_uring *ring, int bgid)
+{
+	struct io_uring_buf_reg reg = { .bgid = bgid };
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd,
+					IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+int io_uring_register_iowq_aff(struct io_uring *ring, size_t cpusz,
+			       const cpu_set_t *mask)
+{
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd, IORING_REGISTER_IOWQ_AFF,
+					mask, cpusz);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+int io_uring_unregister_iowq_aff(struct io_uring *ring)
+{
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd,
+					IORING_UNREGISTER_IOWQ_AFF, NULL, 0);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * values[0] caps bounded workers, values[1] unbounded ones, 0 leaves a limit
+ * unchanged. The previous limits are returned in values.
+ */
+int io_uring_register_iowq_max_workers(struct io_uring *ring,
+				       unsigned int *values)
+{
+	int ret;
+
+	ret = __sys_io_uring_register(ring->ring_fd,
+					IORING_REGISTER_IOWQ_MAX_WORKERS,
+					values, 2);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include "liburing.h"
 
 #include "syscall.h"
+#include "int_flags.h"
 
 static void io_uring_unmap_rings(struct io_uring_sq *sq, struct io_uring_cq *cq)
 {
@@ -95,7 +96,7 @@ int io_uring_queue_mmap(int fd, struct io_uring_params *p, struct io_uring *ring
 	ret = io_uring_mmap(fd, p, &ring->sq, &ring->cq);
 	if (!ret) {
 		ring->flags = p->flags;
-		ring->ring_fd = fd;
+		ring->ring_fd = ring->enter_ring_fd = fd;
 	}
 	return ret;
 }
@@ -144,6 +145,8 @@ int io_uring_queue_init_params(unsigned entries, struct io_uring *ring,
 	ret = io_uring_queue_mmap(fd, p, ring);
 	if (ret)
 		close(fd);
+	else
+		ring->features = p->features;
 
 	return ret;
 }
@@ -169,6 +172,12 @@ void io_uring_queue_exit(struct io_uring *ring)
 
 	munmap(sq->sqes, *sq->kring_entries * sizeof(struct io_uring_sqe));
 	io_uring_unmap_rings(sq, cq);
+	/*
+	 * A registered ring fd holds a reference to the ring until the task
+	 * exits, drop it so closing the fd tears the ring down.
+	 */
+	if (ring->int_flags & INT_FLAG_REG_RING)
+		io_uring_unregister_ring_fd(ring);
 	close(ring->ring_fd);
 }
 
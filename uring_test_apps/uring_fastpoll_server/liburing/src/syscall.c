@@ -3,6 +3,7 @@
  * Will go away once libc support is there
  */
 #include <unistd.h>
+#include <errno.h>
 #include <sys/syscall.h>
 #include <sys/uio.h>
 #include <signal.h>
@@ -42,14 +43,33 @@ int __sys_io_uring_register(int fd, unsigned opcode, const void *arg,
 	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
 }
 
+int io_uring_register(unsigned int fd, unsigned int opcode, const void *arg,
+		      unsigned int nr_args)
+{
+	int ret;
+
+	ret = __sys_io_uring_register(fd, opcode, arg, nr_args);
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
 int __sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
 {
 	return syscall(__NR_io_uring_setup, entries, p);
 }
 
+int __sys_io_uring_enter2(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags, sigset_t *sig, int sz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, sig, sz);
+}
+
 int __sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
 			 unsigned flags, sigset_t *sig)
 {
-	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
-			flags, sig, _NSIG / 8);
+	return __sys_io_uring_enter2(fd, to_submit, min_complete, flags, sig,
+					_NSIG / 8);
 }
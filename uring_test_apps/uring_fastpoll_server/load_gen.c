@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+// load generator for ur_server and the testservers.
+// TCP: closed loop, every connection keeps one message in flight and measures its round trip.
+// unix stream/seqpacket sockets run the same closed loop.
+// UDP: every thread keeps a window of datagrams in flight, packets/sec and drop rate are reported.
+
+//net
+#define SERVER_PORT 7777
+#define SERVER_ADDR "127.0.0.1"
+
+//load
+#define MAX_EVENTS 1024
+#define MAX_MESSAGE_SIZE 65536
+#define UDP_LOSS_TIMEOUT_MS 100   // a window with no reply for this long is counted as lost
+#define UDP_DRAIN_MS 200          // late replies still accepted after the run
+
+//latency histogram, 1us buckets
+#define LATENCY_BUCKETS 100000
+
+
+typedef struct {
+    int socket;
+    size_t received;
+    uint64_t sent_at;
+    char* buffer;
+}
+tcp_connection;
+
+typedef struct {
+    unsigned thread_num;
+
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t sent;
+    uint64_t lost_windows;
+    uint64_t* latency;    // LATENCY_BUCKETS histogram
+}
+thread_result;
+
+typedef struct {
+    int udp;
+    long threads;
+    long connections;     // per thread, TCP
+    long duration;        // seconds
+    long message_size;
+    long window;          // in-flight datagrams per thread, UDP
+    long gso_segments;    // datagrams per sendmsg with UDP_SEGMENT, UDP
+    struct sockaddr_in addr;
+    struct sockaddr_un unix_addr;   // used instead of addr when sun_path is set
+    int unix_type;
+}
+load_config;
+
+load_config config = {
+    .udp = 0,
+    .threads = 1,
+    .connections = 50,
+    .duration = 10,
+    .message_size = 128,
+    .window = 64,
+    .gso_segments = 1,
+    .unix_type = SOCK_STREAM,
+};
+
+volatile int running = 1;
+
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record_latency(thread_result* result, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    if (us >= LATENCY_BUCKETS) {
+        us = LATENCY_BUCKETS - 1;
+    }
+    result->latency[us]++;
+}
+
+
+//
+// TCP
+//
+
+static int tcp_send_message(tcp_connection* conn)
+{
+    size_t sent = 0;
+
+    // messages are small enough to fit the socket buffer, spin on the rare short write
+    while (sent < (size_t)config.message_size) {
+        ssize_t res = send(conn->socket, conn->buffer + sent, config.message_size - sent, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        sent += res;
+    }
+
+    conn->received = 0;
+    conn->sent_at = now_ns();
+    return 0;
+}
+
+void* run_tcp(void* arg)
+{
+    thread_result* result = (thread_result*)arg;
+    tcp_connection* conns = calloc(config.connections, sizeof(tcp_connection));
+    struct epoll_event events[MAX_EVENTS];
+    char buffer[MAX_MESSAGE_SIZE];
+
+    int epollfd = epoll_create1(0);
+    if (epollfd < 0) {
+        perror("Creating epoll FD failed \n");
+        return NULL;
+    }
+
+    for (int i = 0; i < config.connections; i++) {
+        tcp_connection* conn = &conns[i];
+
+        int res;
+        if (config.unix_addr.sun_path[0]) {
+            conn->socket = socket(AF_UNIX, config.unix_type, 0);
+            res = connect(conn->socket, (struct sockaddr *)&config.unix_addr, sizeof(config.unix_addr));
+        }
+        else {
+            conn->socket = socket(AF_INET, SOCK_STREAM, 0);
+            res = connect(conn->socket, (struct sockaddr *)&config.addr, sizeof(config.addr));
+        }
+        if (res < 0) {
+            perror("connect failed \n");
+            return NULL;
+        }
+        fcntl(conn->socket, F_SETFL, O_NONBLOCK);
+
+        conn->buffer = malloc(config.message_size);
+        memset(conn->buffer, 'a' + (i % 26), config.message_size);
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, conn->socket, &ev);
+
+        tcp_send_message(conn);
+    }
+
+    while (running) {
+        int total_events = epoll_wait(epollfd, events, MAX_EVENTS, 100);
+
+        for (int i = 0; i < total_events; i++) {
+            tcp_connection* conn = (tcp_connection*)events[i].data.ptr;
+            ssize_t res = recv(conn->socket, buffer, sizeof(buffer), 0);
+
+            if (res <= 0) {
+                if (res < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                fprintf(stderr, "connection closed by server \n");
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->socket, NULL);
+                continue;
+            }
+
+            conn->received += res;
+            result->bytes += res;
+
+            if (conn->received >= (size_t)config.message_size) {
+                record_latency(result, now_ns() - conn->sent_at);
+                result->messages++;
+                if (running) {
+                    tcp_send_message(conn);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < config.connections; i++) {
+        close(conns[i].socket);
+        free(conns[i].buffer);
+    }
+    free(conns);
+    close(epollfd);
+    return NULL;
+}
+
+
+//
+// UDP
+//
+
+typedef struct {
+    uint64_t seq;
+    uint64_t sent_at;
+}
+datagram_header;
+
+static int udp_send_batch(int sock, char* buffer, uint64_t* seq)
+{
+    long segments = config.gso_segments;
+    uint64_t sent_at = now_ns();
+
+    for (long i = 0; i < segments; i++) {
+        datagram_header* hdr = (datagram_header*)(buffer + i * config.message_size);
+        hdr->seq = (*seq)++;
+        hdr->sent_at = sent_at;
+    }
+
+    if (segments == 1) {
+        return send(sock, buffer, config.message_size, 0) < 0 ? -1 : 1;
+    }
+
+    // one sendmsg, the stack cuts it into message_size datagrams
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct iovec iov = { .iov_base = buffer, .iov_len = segments * config.message_size };
+    struct msghdr msg;
+    struct cmsghdr* cm;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *((uint16_t *)CMSG_DATA(cm)) = config.message_size;
+
+    return sendmsg(sock, &msg, 0) < 0 ? -1 : segments;
+}
+
+void* run_udp(void* arg)
+{
+    thread_result* result = (thread_result*)arg;
+    char* send_buffer = calloc(config.gso_segments, config.message_size);
+    char recv_buffer[MAX_MESSAGE_SIZE];
+    uint64_t seq = 0;
+    long inflight = 0;
+    uint64_t window_start = 0;      // first seq sent since the last lost window
+    uint64_t last_reply = now_ns();
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (connect(sock, (struct sockaddr *)&config.addr, sizeof(config.addr)) < 0) {
+        perror("connect failed \n");
+        return NULL;
+    }
+
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 10000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while (running) {
+        while (inflight + config.gso_segments <= config.window) {
+            int res = udp_send_batch(sock, send_buffer, &seq);
+            if (res < 0) {
+                break;
+            }
+            result->sent += res;
+            inflight += res;
+        }
+
+        ssize_t res = recv(sock, recv_buffer, sizeof(recv_buffer), 0);
+        if (res >= (ssize_t)sizeof(datagram_header)) {
+            datagram_header* hdr = (datagram_header*)recv_buffer;
+            record_latency(result, now_ns() - hdr->sent_at);
+            result->messages++;
+            result->bytes += res;
+            last_reply = now_ns();
+
+            // a late reply from a window written off as lost was already taken out of inflight
+            if (hdr->seq >= window_start && inflight > 0) {
+                inflight--;
+            }
+        }
+        else if (now_ns() - last_reply > UDP_LOSS_TIMEOUT_MS * 1000000ULL) {
+            // nothing came back for a while, the window was dropped somewhere
+            result->lost_windows++;
+            inflight = 0;
+            window_start = seq;
+            last_reply = now_ns();
+        }
+    }
+
+    // collect replies that were still on the way
+    uint64_t drain_until = now_ns() + UDP_DRAIN_MS * 1000000ULL;
+    while (now_ns() < drain_until) {
+        ssize_t res = recv(sock, recv_buffer, sizeof(recv_buffer), 0);
+        if (res >= (ssize_t)sizeof(datagram_header)) {
+            result->messages++;
+            result->bytes += res;
+        }
+    }
+
+    close(sock);
+    free(send_buffer);
+    return NULL;
+}
+
+
+static uint64_t latency_percentile(uint64_t* hist, uint64_t total, double pct)
+{
+    uint64_t target = (uint64_t)(total * pct / 100.0);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            return i;
+        }
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+
+int main(int argc, char* argv[])
+{
+    // parse params
+    int opt;
+
+    memset(&config.addr, 0, sizeof(config.addr));
+    config.addr.sin_family = AF_INET;
+    config.addr.sin_port = htons(SERVER_PORT);
+    inet_pton(AF_INET, SERVER_ADDR, &config.addr.sin_addr);
+
+    while((opt = getopt(argc, argv, "t:c:d:m:w:g:a:p:uU:Qh")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                config.threads = strtol(optarg, NULL, 10);
+                break;
+            case 'c':
+                config.connections = strtol(optarg, NULL, 10);
+                break;
+            case 'd':
+                config.duration = strtol(optarg, NULL, 10);
+                break;
+            case 'm':
+                config.message_size = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                config.window = strtol(optarg, NULL, 10);
+                break;
+            case 'g':
+                config.gso_segments = strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &config.addr.sin_addr) != 1) {
+                    printf("invalid server address %s \n", optarg);
+                    return 1;
+                }
+                break;
+            case 'p':
+                config.addr.sin_port = htons(strtol(optarg, NULL, 10));
+                break;
+            case 'u':
+                config.udp = 1;
+                break;
+            case 'U':
+                if (strlen(optarg) >= sizeof(config.unix_addr.sun_path)) {
+                    printf("unix socket path too long: %s \n", optarg);
+                    return 1;
+                }
+                config.unix_addr.sun_family = AF_UNIX;
+                strcpy(config.unix_addr.sun_path, optarg);
+                break;
+            case 'Q':
+                config.unix_type = SOCK_SEQPACKET;
+                break;
+            case 'h':
+                printf("usage -t: number of threads. defaults to 1 \n");
+                printf("      -c: TCP connections per thread. defaults to 50 \n");
+                printf("      -d: duration in seconds. defaults to 10 \n");
+                printf("      -m: message size in bytes. defaults to 128 \n");
+                printf("      -a: server address. defaults to %s \n", SERVER_ADDR);
+                printf("      -p: server port. defaults to %i \n", SERVER_PORT);
+                printf("      -u: UDP mode, reports packets/sec and drop rate \n");
+                printf("      -w: UDP in-flight datagrams per thread. defaults to 64 \n");
+                printf("      -g: UDP datagrams per sendmsg using UDP_SEGMENT (GSO). defaults to 1 \n");
+                printf("      -U: connect to a unix socket at this path instead of TCP \n");
+                printf("      -Q: unix socket is SOCK_SEQPACKET \n");
+                return 0;
+        }
+    }
+
+    if (config.udp && config.unix_addr.sun_path[0]) {
+        printf("UDP and unix socket modes are exclusive \n");
+        return 1;
+    }
+
+    if (config.threads < 1 || config.connections < 1 || config.duration < 1) {
+        printf("threads, connections and duration must be > 0 \n");
+        return 1;
+    }
+    if (config.message_size < (long)sizeof(datagram_header) || config.message_size > MAX_MESSAGE_SIZE) {
+        printf("message size must be between %zu and %i \n", sizeof(datagram_header), MAX_MESSAGE_SIZE);
+        return 1;
+    }
+    if (config.gso_segments < 1 || config.gso_segments * config.message_size > MAX_MESSAGE_SIZE || config.window < config.gso_segments) {
+        printf("GSO batch must fit in %i bytes and in the window \n", MAX_MESSAGE_SIZE);
+        return 1;
+    }
+
+    printf("%s load: %li threads, %s, %li byte messages, %li seconds \n",
+           config.udp ? "UDP" : config.unix_addr.sun_path[0] ? (config.unix_type == SOCK_SEQPACKET ? "unix seqpacket" : "unix stream") : "TCP",
+           config.threads,
+           config.udp ? "datagram window per thread" : "closed loop connections",
+           config.message_size, config.duration);
+
+    thread_result* results = calloc(config.threads, sizeof(thread_result));
+    pthread_t* t_ids = malloc(sizeof(pthread_t) * config.threads);
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < config.threads; i++) {
+        results[i].thread_num = i;
+        results[i].latency = calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+        pthread_create(&t_ids[i], NULL, config.udp ? &run_udp : &run_tcp, (void*)&results[i]);
+    }
+
+    sleep(config.duration);
+    running = 0;
+    double elapsed = (now_ns() - start) / 1e9;
+
+    for (int i = 0; i < config.threads; i++) {
+        pthread_join(t_ids[i], NULL);
+    }
+
+
+    // merge and report
+    thread_result total;
+    memset(&total, 0, sizeof(total));
+    total.latency = calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+
+    for (int i = 0; i < config.threads; i++) {
+        total.messages += results[i].messages;
+        total.bytes += results[i].bytes;
+        total.sent += results[i].sent;
+        total.lost_windows += results[i].lost_windows;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            total.latency[b] += results[i].latency[b];
+        }
+    }
+
+    uint64_t timed = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        timed += total.latency[b];
+    }
+
+    if (config.udp) {
+        double drop = total.sent ? 100.0 * (double)(total.sent - (total.messages < total.sent ? total.messages : total.sent)) / total.sent : 0;
+        printf("sent: %lu, received: %lu, drop rate: %.3f%%, lost windows: %lu \n",
+               total.sent, total.messages, drop, total.lost_windows);
+        printf("packets/sec: %.0f, MB/sec: %.2f \n", total.messages / elapsed, total.bytes / elapsed / 1e6);
+    }
+    else {
+        printf("messages: %lu, messages/sec: %.0f, MB/sec: %.2f \n",
+               total.messages, total.messages / elapsed, total.bytes / elapsed / 1e6);
+    }
+
+    if (timed) {
+        printf("latency us: p50 %lu, p90 %lu, p99 %lu, p99.9 %lu \n",
+               latency_percentile(total.latency, timed, 50),
+               latency_percentile(total.latency, timed, 90),
+               latency_percentile(total.latency, timed, 99),
+               latency_percentile(total.latency, timed, 99.9));
+    }
+
+    return 0;
+}
@@ -4,9 +4,22 @@
 
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
 
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
 
 #include <liburing.h>  
 
@@ -16,19 +29,68 @@
 //net
 #define LISTEN_PORT 7777
 #define LISTEN_BACKLOG 10000
+#define MAX_UNIX_LISTENERS 2    // one SOCK_STREAM, one SOCK_SEQPACKET
 
 //net app
 #define CLIENT_MESSAGE_SIZE 1024
 #define CONNECTIONS_POOL_SIZE 10000 
 
+//net app, datagram mode
+#define UDP_BATCH_SIZE 64       // in-flight recvmsg per thread
+#define UDP_MESSAGE_SIZE 65536  // UDP_GRO may coalesce up to 64k
+#define UDP_HEADROOM 256        // multishot recvmsg header, address and cmsg
+#define UDP_CONTROL_SIZE CMSG_SPACE(sizeof(int))
+#define UDP_BUFFER_GROUP 1
+
+//net app, splice mode
+#define SPLICE_CHUNK 65536      // default pipe capacity, most bytes moved per socket->pipe splice
+
+//net app, zero-copy send mode
+#define ZC_BUFFER_SIZE 65536
+#define ZC_POOL_SIZE 128        // registered buffers per thread
+
 //io
 #define IO_URING_LEN 32768
+#define MAX_THREADS 64
+#define SQPOLL_IDLE_MSEC 1000   // SQ thread sleeps after this long without submissions
+#define EP_MAX_EVENTS 1024      // readiness events taken per epoll_wait, epoll backend
+
+//elastic thread pool
+#define ELASTIC_INTERVAL 1      // seconds between utilization samples
+#define ELASTIC_PATIENCE 3      // samples in a row above/below the limits before scaling
+#define ELASTIC_HIGH 0.75       // mean ring thread utilization that adds a thread
+#define ELASTIC_LOW 0.25        // mean ring thread utilization that retires one
+
+//prefork workers
+#define PREFORK_RETRY_SEC 1     // wait before forking a worker again after fork() failed
+
+//admission control
+#define ADMISSION_RESUME 0.75   // share of the limits a paused thread has to get under to accept again
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
 
 
 enum socket_state {
     ACCEPT,
     READ,
     WRITE,
+    RECVMSG,
+    SENDMSG,
+    PROVIDE_BUFFER,
+    SPLICE_POLL,
+    SPLICE_IN,
+    SPLICE_OUT,
+    ZC_READ,
+    ZC_WRITE,
+    ZC_SEND,
+    CONTROL,
+    CANCEL,
+    MIGRATE_OUT,
+    MIGRATE_IN,
 };
 
 typedef struct {
@@ -37,163 +99,2347 @@ typedef struct {
 } 
 io_connection_data;
 
+// one in-flight datagram. in multishot mode the buffer is provided to the kernel with bid = slot index
+typedef struct {
+    io_connection_data op;
+    unsigned index;
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in6 addr;
+    char control[UDP_CONTROL_SIZE];
+    char buffer[UDP_MESSAGE_SIZE + UDP_HEADROOM];
+}
+io_datagram_slot;
+
+typedef struct {
+    int multishot;          // multishot recvmsg in use
+    int multishot_armed;    // multishot recvmsg currently posted
+    struct msghdr multishot_msg;
+    io_connection_data multishot_op;
+    io_datagram_slot slots[UDP_BATCH_SIZE];
+}
+ur_datagram_context;
+
+// zero-copy echo, payload moves socket -> pipe -> socket and never enters userspace
+typedef struct {
+    io_connection_data poll_op;
+    io_connection_data in_op;
+    io_connection_data out_op;
+    int pipe[2];
+    unsigned pending;       // bytes sitting in the pipe
+    int eligible;           // socket type supports splice_read
+    int closing;
+}
+io_splice_connection;
+
+// a registered buffer. after SEND_ZC it stays with the kernel until the F_NOTIF CQE
+typedef struct {
+    io_connection_data op;      // op.socket is the connection it was last sent on
+    unsigned index;
+}
+io_zc_buffer;
+
+typedef struct {
+    char* memory;               // ZC_POOL_SIZE buffers of ZC_BUFFER_SIZE, registered with the ring
+    io_zc_buffer buffers[ZC_POOL_SIZE];
+    unsigned free[ZC_POOL_SIZE];
+    unsigned free_count;
+    int conn_buffer[CONNECTIONS_POOL_SIZE];     // buffer a connection receives into
+}
+ur_zc_context;
+
+// per thread counters, written only by the owning thread and sampled by the stats thread or loop
+typedef struct {
+    unsigned long messages;     // echoed reads or datagrams
+    unsigned long bytes;
+    unsigned long wakeups;      // returns from the wait in the main loop
+    unsigned long cqes;
+    unsigned long spin_hits;    // wakeups served by spinning on the CQ, no syscall
+    unsigned long eventfd_wakeups;  // embedded mode, wakeups that took an eventfd signal
+    unsigned long shed;         // connections closed right after accept
+    unsigned long pauses;       // times admission control stopped accepting
+    unsigned long paused;       // 1 while paused
+}
+__attribute__((aligned(64)))
+ur_thread_stats;
+
+// server wide rates are printed against the previous sample
+typedef struct {
+    long threads;
+    ur_thread_stats prev;
+    double prev_cpu;
+    long prev_switches;
+    struct timespec prev_ts;
+}
+ur_stats_sampler;
+
+enum ep_op_kind {
+    EP_NONE,
+    EP_ACCEPT,
+    EP_RECV,
+    EP_SEND,
+};
+
+// op posted on a socket and not completed yet, at most one per socket like conn_pool
+typedef struct {
+    int kind;
+    char* buffer;
+    size_t size;
+    size_t done;                // bytes sent so far
+    struct sockaddr* addr;
+    socklen_t* addr_len;
+    void* user_data;
+}
+ep_pending_op;
+
+typedef struct {
+    int epoll_fd;
+    ep_pending_op ops[CONNECTIONS_POOL_SIZE];
+    char listening[CONNECTIONS_POOL_SIZE];          // listeners already added to epoll_fd
+    struct io_uring_cqe completions[IO_URING_LEN];  // synthesized CQEs waiting for the main loop
+    unsigned completion_count;
+    struct epoll_event events[EP_MAX_EVENTS];
+}
+ur_epoll_context;
+
 typedef struct {
     struct io_uring uring;
+    ur_epoll_context* ep;                   // epoll backend only, uring is unused then
+    ur_thread_stats* stats;
+    int batch_wait;
+    struct __kernel_timespec batch_ts;
+    int host_epoll;                         // embedded mode, the host loop and the ring eventfd it watches
+    int ring_eventfd;
     io_connection_data conn_pool[CONNECTIONS_POOL_SIZE]; 
     char messages_buffer[CONNECTIONS_POOL_SIZE][CLIENT_MESSAGE_SIZE];  
+    ur_datagram_context* dgram;
+    io_splice_connection* splice_pool;     // indexed by socket like conn_pool, NULL when splice is off
+    ur_zc_context* zc;                      // NULL when zero-copy send is off
+
+    // elastic mode, a retiring ring stops accepting and hands its connections to the others
+    char open[CONNECTIONS_POOL_SIZE];       // connections owned by this ring
+    char accept_armed[CONNECTIONS_POOL_SIZE];   // listeners with an accept in flight
+    int admission_paused;
+    unsigned open_count;
+    unsigned armed_accepts;
+    unsigned pending_control;               // cancels and migrations not completed yet
+    int retiring;
+    unsigned next_target;
+    uint64_t control_value;
+    io_connection_data control_op;          // read on the slot eventfd, completes when the controller calls
+    io_connection_data cancel_op;
+    io_connection_data migrate_op;          // user data of connections arriving with MSG_RING
 } 
 ur_thread_context;
 
+// what the main loop runs on. ops complete as io_uring CQEs on either backend, so the
+// connection state machine doesn't know which one it is on
+typedef struct {
+    const char* name;
+    int (*setup)(ur_thread_context* context, int thread_num, cpu_set_t* cpuset);
+    int (*wait)(ur_thread_context* context, struct io_uring_cqe** cqes, unsigned count);   // returns CQEs ready
+    void (*seen)(ur_thread_context* context, unsigned count);
+    void (*accept)(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len, void* user_data);
+    void (*recv)(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data);
+    void (*send)(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data);
+    void (*cancel)(ur_thread_context* context, io_connection_data* target, void* user_data);
+}
+ur_backend;
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_RUNNING,
+    SLOT_EXITED,    // retired, waiting to be joined
+};
+
+typedef struct {
+    pthread_t tid;
+    int state;
+    int retire;
+    int control_fd;                 // eventfd, wakes the ring thread up to look at retire
+    double cpu;                     // thread CPU seconds at the last sample
+    ur_thread_context* context;     // published once the ring is up, NULL after retirement
+}
+ur_thread_slot;
+
 typedef struct {
    unsigned listener_socket;
    unsigned thread_num;
 }
-thread_params;
+thread_params;
+
+typedef struct {
+    int udp;                // datagram echo instead of TCP
+
+    // AF_UNIX listeners accepted on by every thread next to TCP
+    const char* unix_stream_path;
+    const char* unix_seqpacket_path;
+    int unix_listeners[MAX_UNIX_LISTENERS];
+    int unix_listeners_count;
+    int unix_seqpacket_listener;    // -1 if none, seqpacket sockets can't be spliced
+
+    // completion batching: wake up on batch_count CQEs or after batch_wait_usec, whichever comes first
+    unsigned batch_count;
+    unsigned batch_wait_usec;   // 0 = wake up on the first CQE
+
+    unsigned stats_interval;    // seconds, 0 = no stats
+
+    unsigned splice_threshold;  // a connection echoing payloads this large moves to splice, 0 = off
+
+    // connections with payloads over CLIENT_MESSAGE_SIZE move to registered buffers,
+    // replies of zc_threshold bytes or more then go out with SEND_ZC. 0 = off
+    unsigned zc_threshold;
+
+    // io-wq worker caps per ring, 0 = kernel default. workers are also pinned to the ring's CPU
+    unsigned iowq_bounded;
+    unsigned iowq_unbounded;
+
+    unsigned spin_usec;         // spin on the CQ tail this long before a blocking wait, 0 = always block
+
+    // ring threads scale between these with load, 0 = fixed thread count
+    unsigned elastic_min;
+    unsigned elastic_max;
+
+    unsigned prefork;           // worker processes with one ring each instead of ring threads, 0 = threaded
+
+    int backend;                // enum ur_backend_choice
+
+    // admission control per thread, 0 = no limit. at max_conns open connections or a backlog of
+    // max_backlog CQEs per wakeup the thread stops accepting, new clients wait in the listen backlog
+    unsigned max_conns;
+    unsigned max_backlog;
+    int shed;                   // keep accepting while paused but close new connections right away
+}
+ur_server_config;
+
+enum ur_backend_choice {
+    BACKEND_AUTO,       // io_uring, epoll if the kernel has none or it is disabled
+    BACKEND_URING,
+    BACKEND_EPOLL,
+    BACKEND_EMBED,      // io_uring rings driven from an epoll loop through an eventfd
+};
+
+ur_server_config server_config = { .udp = 0, .batch_count = 1, .unix_seqpacket_listener = -1 };
+
+// io_uring capabilities probed at startup, the same binary picks its fast paths per kernel
+enum ur_feature {
+    FEAT_MULTISHOT_ACCEPT,
+    FEAT_MULTISHOT_RECV,
+    FEAT_BUFFER_RING,
+    FEAT_DIRECT_DESCRIPTORS,
+    FEAT_SEND_ZC,
+    FEAT_SQPOLL,
+    FEAT_DEFER_TASKRUN,
+    FEAT_EXT_ARG,
+    FEAT_RESIZE_RINGS,
+    FEAT_IOWQ_LIMITS,
+    FEAT_MSG_RING,
+    FEAT_COUNT,
+};
+
+typedef struct {
+    const char* name;
+    int implemented;    // the server has a code path using it
+    int preferred;      // used by default when supported
+    int supported;      // set by probe_features()
+    int override;       // 1 forced on, -1 forced off, 0 auto
+    int enabled;
+}
+ur_feature_info;
+
+ur_feature_info features[FEAT_COUNT] = {
+    [FEAT_MULTISHOT_ACCEPT]   = { "multishot_accept",   1, 1 },
+    [FEAT_MULTISHOT_RECV]     = { "multishot_recv",     1, 1 },
+    [FEAT_BUFFER_RING]        = { "buffer_ring",        0, 1 },
+    [FEAT_DIRECT_DESCRIPTORS] = { "direct_descriptors", 0, 1 },
+    [FEAT_SEND_ZC]            = { "send_zc",            1, 1 },    // needs -Z, only pays off for large payloads
+    [FEAT_SQPOLL]             = { "sqpoll",             1, 0 },    // burns a core per ring, default with -P
+    [FEAT_DEFER_TASKRUN]      = { "defer_taskrun",      1, 1 },
+    [FEAT_EXT_ARG]            = { "ext_arg",            1, 1 },
+    [FEAT_RESIZE_RINGS]       = { "resize_rings",       0, 0 },
+    [FEAT_IOWQ_LIMITS]        = { "iowq_limits",        1, 1 },    // needs -q
+    [FEAT_MSG_RING]           = { "msg_ring",           1, 1 },    // elastic mode connection handover
+};
+
+extern ur_backend uring_backend, epoll_backend, embed_backend;
+ur_backend* backend = &uring_backend;
+
+ur_thread_stats* thread_stats;
+
+ur_thread_slot thread_slots[MAX_THREADS];
+unsigned long elastic_added, elastic_retired;
+
+pid_t worker_pids[MAX_THREADS];     // prefork mode, read by the stats in the supervisor loop
+unsigned long worker_restarts;
+
+
+void io_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len);
+void io_read(ur_thread_context* context, int socket, size_t size);
+void io_write(ur_thread_context* context, int socket, size_t size);
+
+void io_recvmsg(ur_thread_context* context, int socket, io_datagram_slot* slot);
+void io_recvmsg_multishot(ur_thread_context* context, int socket);
+void io_sendmsg(ur_thread_context* context, int socket, io_datagram_slot* slot, void* name, socklen_t name_len, void* data, size_t size, int gso_size);
+void io_provide_buffer(ur_thread_context* context, io_datagram_slot* slot);
+void datagram_start(ur_thread_context* context, int socket);
+void datagram_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats);
+
+int splice_start(ur_thread_context* context, int socket);
+void io_splice_arm(ur_thread_context* context, int socket);
+void io_splice_out(ur_thread_context* context, int socket, unsigned size);
+void splice_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats);
+
+ur_zc_context* zc_setup(struct io_uring* uring);
+int zc_start(ur_thread_context* context, int socket);
+void io_zc_read(ur_thread_context* context, int socket);
+void io_zc_write(ur_thread_context* context, int socket, size_t size);
+void io_zc_send(ur_thread_context* context, int socket, unsigned buffer, size_t size);
+void zc_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats);
+
+void io_control_read(ur_thread_context* context, int fd);
+void io_cancel(ur_thread_context* context, io_connection_data* target);
+void conn_idle(ur_thread_context* context, int socket);
+void conn_close(ur_thread_context* context, int socket);
+void context_free(ur_thread_context* context);
+int admission_refuse(ur_thread_context* context);
+void admission_update(ur_thread_context* context, unsigned backlog, int sock_listen, struct sockaddr *cli_addr, socklen_t *addr_len);
+void elastic_retire(ur_thread_context* context, int sock_listen);
+int elastic_migrate(ur_thread_context* context, int socket);
+void elastic_spawn(thread_params* tp);
+void launch_elastic(thread_params* tp_arr);
+
+pid_t prefork_worker(thread_params* tp);
+void prefork_restart(thread_params* tp_arr, long workers, pid_t pid, int status);
+void launch_prefork(thread_params* tp_arr, long workers);
+
+void stats_begin(ur_stats_sampler* sampler, long threads);
+void stats_print(ur_stats_sampler* sampler);
+
+int probe_features();
+int feature_override(const char* arg);
+void log_features();
+
+
+
+// busy-polls the CQ tail, returns 0 if nothing showed up within usec
+static int spin_for_cqe(struct io_uring* ring, unsigned usec)
+{
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        for (int i = 0; i < 128; i++) {
+            if (io_uring_cq_ready(ring)) {
+                return 1;
+            }
+            cpu_relax();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 < (long)usec);
+
+    return 0;
+}
+
+// io_uring backend
+
+int uring_setup(ur_thread_context* context, int thread_num, cpu_set_t* cpuset)
+{
+    struct io_uring_params p;
+    int res;
+
+    memset(&p, 0, sizeof(p));
+
+    const char* taskrun_mode = "default";
+
+    if (features[FEAT_SQPOLL].enabled) {
+        // submissions are picked up by a kernel thread, the loop only enters to wait
+        p.flags = IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQPOLL_IDLE_MSEC;
+        taskrun_mode = "sq thread";
+    }
+
+    if (features[FEAT_DEFER_TASKRUN].enabled) {
+        // only this pinned thread touches the ring, completions wait for our enter instead of IPIs
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        taskrun_mode = "single issuer, deferred";
+    }
+
+    res = io_uring_queue_init_params(IO_URING_LEN, &context->uring, &p);
+
+    if (res == -EINVAL && features[FEAT_DEFER_TASKRUN].enabled) {
+        // DEFER_TASKRUN needs kernel 6.1, cooperative task run (5.19) still avoids the IPIs
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_COOP_TASKRUN;
+        taskrun_mode = "cooperative";
+        res = io_uring_queue_init_params(IO_URING_LEN, &context->uring, &p);
+
+        if (res == -EINVAL) {
+            memset(&p, 0, sizeof(p));
+            taskrun_mode = "default";
+            res = io_uring_queue_init_params(IO_URING_LEN, &context->uring, &p);
+        }
+    }
+
+    if (res < 0) {
+        perror("io_uring_init failed. \n");
+        return -1;
+    }
+
+    if (features[FEAT_DEFER_TASKRUN].enabled || features[FEAT_SQPOLL].enabled) {
+        // enter by registered index, saves the fd lookup on every io_uring_enter
+        int registered = io_uring_register_ring_fd(&context->uring) == 1;
+
+        if (thread_num == 0) {
+            printf("Ring task run mode: %s, ring fd %s \n", taskrun_mode, registered ? "registered" : "not registered");
+        }
+    }
+
+    if (features[FEAT_IOWQ_LIMITS].enabled) {
+        // ops that can't arm poll (splice, short sends) are punted to io-wq workers, keep them few and on our CPU
+        unsigned limits[2] = { server_config.iowq_bounded, server_config.iowq_unbounded };
+
+        if (io_uring_register_iowq_max_workers(&context->uring, limits) < 0
+            || io_uring_register_iowq_aff(&context->uring, sizeof(*cpuset), cpuset) < 0) {
+            printf("io-wq limits not applied in thread# %i \n", thread_num);
+        }
+    }
+
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        perror("IORING_FEAT_FAST_POLL not supported. kernel 5.7 needed. \n");
+        return -1;
+    }
+
+    // batched waits pass the timeout with the enter call, a timeout SQE would show up in the CQ as a foreign CQE
+    context->batch_wait = server_config.batch_wait_usec > 0;
+
+    if (context->batch_wait && !features[FEAT_EXT_ARG].enabled) {
+        printf("IORING_FEAT_EXT_ARG not available (kernel 5.11 needed or turned off). completion batching disabled \n");
+        context->batch_wait = 0;
+    }
+    context->batch_ts.tv_sec = server_config.batch_wait_usec / 1000000;
+    context->batch_ts.tv_nsec = (server_config.batch_wait_usec % 1000000) * 1000;
+
+    if (features[FEAT_SEND_ZC].enabled && !server_config.udp) {
+        context->zc = zc_setup(&context->uring);
+    }
+
+    return 0;
+}
+
+// submits everything queued and waits for completions, returns the CQEs ready
+int uring_wait(ur_thread_context* context, struct io_uring_cqe** cqes, unsigned count)
+{
+    if (server_config.spin_usec) {
+        // with SQPOLL this doesn't enter the kernel unless the SQ thread went idle
+        io_uring_submit(&context->uring);
+
+        if (spin_for_cqe(&context->uring, server_config.spin_usec)) {
+            context->stats->spin_hits++;
+        }
+        else {
+            io_uring_submit_and_wait(&context->uring, 1);
+        }
+    }
+    else if (context->batch_wait) {
+        struct io_uring_cqe *cqe;
+        io_uring_submit_and_wait_timeout(&context->uring, &cqe, server_config.batch_count, &context->batch_ts, NULL);
+    }
+    else {
+        io_uring_submit_and_wait(&context->uring, 1);
+    }
+
+    return io_uring_peek_batch_cqe(&context->uring, cqes, count);
+}
+
+void uring_seen(ur_thread_context* context, unsigned count)
+{
+    io_uring_cq_advance(&context->uring, count);
+}
+
+void uring_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len, void* user_data)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&context->uring);
+
+    if (features[FEAT_MULTISHOT_ACCEPT].enabled) {
+        io_uring_prep_multishot_accept(sqe, socket, cli_addr, addr_len, 0);
+    }
+    else {
+        io_uring_prep_accept(sqe, socket, cli_addr, addr_len, 0);
+    }
+
+    io_uring_sqe_set_data(sqe, user_data);
+}
+
+void uring_recv(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_recv(sqe, socket, buffer, size, 0);
+    io_uring_sqe_set_data(sqe, user_data);
+}
+
+void uring_send(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_send(sqe, socket, buffer, size, 0);
+    io_uring_sqe_set_data(sqe, user_data);
+}
+
+void uring_cancel(ur_thread_context* context, io_connection_data* target, void* user_data)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_cancel(sqe, target, 0);
+    io_uring_sqe_set_data(sqe, user_data);
+}
+
+ur_backend uring_backend = { "io_uring", uring_setup, uring_wait, uring_seen, uring_accept, uring_recv, uring_send, uring_cancel };
+
+// io_uring embedded in an epoll loop. the loop here stands in for the one of a hosting service,
+// all it needs is the ring eventfd in its epoll set and a call to drain when it fires
+
+int embed_setup(ur_thread_context* context, int thread_num, cpu_set_t* cpuset)
+{
+    if (uring_setup(context, thread_num, cpuset) < 0) {
+        return -1;
+    }
+
+    context->ring_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    context->host_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (context->ring_eventfd < 0 || context->host_epoll < 0) {
+        perror("eventfd/epoll_create1 failed. \n");
+        return -1;
+    }
+
+    if (io_uring_register_eventfd(&context->uring, context->ring_eventfd) < 0) {
+        perror("io_uring_register_eventfd failed. \n");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = context->ring_eventfd };
+    if (epoll_ctl(context->host_epoll, EPOLL_CTL_ADD, context->ring_eventfd, &ev) < 0) {
+        perror("epoll_ctl ADD failed for the ring eventfd. \n");
+        return -1;
+    }
+
+    // signals are only wanted while the loop sleeps, not for every CQE posted while it drains
+    if (io_uring_cq_eventfd_toggle(&context->uring, false) < 0 && thread_num == 0) {
+        printf("IORING_CQ_EVENTFD_DISABLED not supported (kernel 5.8 needed), every CQE signals the eventfd \n");
+    }
+    return 0;
+}
+
+int embed_wait(ur_thread_context* context, struct io_uring_cqe** cqes, unsigned count)
+{
+    struct io_uring* ring = &context->uring;
+
+    io_uring_submit(ring);
+
+    if (!io_uring_cq_ready(ring)) {
+        io_uring_cq_eventfd_toggle(ring, true);
+
+        // a CQE posted before the toggle didn't signal
+        if (!io_uring_cq_ready(ring)) {
+            struct epoll_event ev;
+            eventfd_t value;
+
+            // interrupted by task work running the completions is as good as a signal
+            if (epoll_wait(context->host_epoll, &ev, 1, -1) == 1) {
+                eventfd_read(context->ring_eventfd, &value);
+                context->stats->eventfd_wakeups++;
+            }
+        }
+        io_uring_cq_eventfd_toggle(ring, false);
+    }
+
+    return io_uring_peek_batch_cqe(ring, cqes, count);
+}
+
+ur_backend embed_backend = { "io_uring embedded in epoll", embed_setup, embed_wait, uring_seen, uring_accept, uring_recv, uring_send, uring_cancel };
+
+// epoll backend, emulates the completion model on readiness: an op is tried right away and
+// again on every readiness event until it stops returning EAGAIN, then its CQE is queued
+
+int ep_setup(ur_thread_context* context, int thread_num, cpu_set_t* cpuset)
+{
+    context->ep = malloc(sizeof(ur_epoll_context));
+    memset(context->ep, 0, sizeof(ur_epoll_context));
+
+    context->ep->epoll_fd = epoll_create1(0);
+    if (context->ep->epoll_fd < 0) {
+        perror("epoll_create1 failed. \n");
+        return -1;
+    }
+    return 0;
+}
+
+static void ep_post(ur_epoll_context* ep, void* user_data, int res)
+{
+    struct io_uring_cqe* cqe = &ep->completions[ep->completion_count++];
+
+    cqe->user_data = (uint64_t)(uintptr_t)user_data;
+    cqe->res = res;
+    cqe->flags = 0;
+}
+
+static void ep_complete(ur_epoll_context* ep, int socket, int res)
+{
+    ep_pending_op* op = &ep->ops[socket];
+
+    ep_post(ep, op->user_data, res);
+    op->kind = EP_NONE;
+}
+
+// runs the op pending on socket, leaves it pending if the socket isn't ready
+static void ep_try(ur_thread_context* context, int socket)
+{
+    ur_epoll_context* ep = context->ep;
+    ep_pending_op* op = &ep->ops[socket];
+    int res;
+
+    switch (op->kind) {
+        case EP_ACCEPT:
+            res = accept4(socket, op->addr, op->addr_len, SOCK_NONBLOCK);
+            if (res < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                res = -errno;
+            }
+            else {
+                // registered once for both directions, edge triggered: ops are always tried before waiting
+                struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.fd = res };
+                epoll_ctl(ep->epoll_fd, EPOLL_CTL_ADD, res, &ev);
+            }
+            break;
+
+        case EP_RECV:
+            res = recv(socket, op->buffer, op->size, MSG_DONTWAIT);
+            if (res < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                res = -errno;
+            }
+            break;
+
+        case EP_SEND:
+            // completes once everything is out, like a send on a blocking socket
+            while (op->done < op->size) {
+                res = send(socket, op->buffer + op->done, op->size - op->done, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (res < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    break;
+                }
+                op->done += res;
+            }
+            res = res < 0 ? -errno : (int)op->done;
+            break;
+
+        default:
+            // a paused listener leaves the set until accepting resumes, level triggered it would keep waking us
+            if (ep->listening[socket]) {
+                epoll_ctl(ep->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+                ep->listening[socket] = 0;
+            }
+            return;
+    }
+
+    ep_complete(ep, socket, res);
+}
+
+int ep_wait(ur_thread_context* context, struct io_uring_cqe** cqes, unsigned count)
+{
+    ur_epoll_context* ep = context->ep;
+
+    // ops that completed right away don't need a readiness event
+    int events = epoll_wait(ep->epoll_fd, ep->events, EP_MAX_EVENTS, ep->completion_count ? 0 : -1);
+
+    for (int i = 0; i < events; i++) {
+        ep_try(context, ep->events[i].data.fd);
+    }
+
+    unsigned total = ep->completion_count < count ? ep->completion_count : count;
+    for (unsigned i = 0; i < total; i++) {
+        cqes[i] = &ep->completions[i];
+    }
+    return total;
+}
+
+void ep_seen(ur_thread_context* context, unsigned count)
+{
+    ur_epoll_context* ep = context->ep;
+
+    // completions queued while handling this batch move to the front
+    ep->completion_count -= count;
+    memmove(ep->completions, ep->completions + count, ep->completion_count * sizeof(struct io_uring_cqe));
+}
+
+void ep_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len, void* user_data)
+{
+    ur_epoll_context* ep = context->ep;
+
+    if (!ep->listening[socket]) {
+        // every thread waits on the same listeners, EPOLLEXCLUSIVE wakes one of them per connection
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = socket };
+        epoll_ctl(ep->epoll_fd, EPOLL_CTL_ADD, socket, &ev);
+        ep->listening[socket] = 1;
+    }
+
+    ep->ops[socket] = (ep_pending_op){ .kind = EP_ACCEPT, .addr = cli_addr, .addr_len = addr_len, .user_data = user_data };
+    ep_try(context, socket);
+}
+
+void ep_recv(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data)
+{
+    context->ep->ops[socket] = (ep_pending_op){ .kind = EP_RECV, .buffer = buffer, .size = size, .user_data = user_data };
+    ep_try(context, socket);
+}
+
+void ep_send(ur_thread_context* context, int socket, void* buffer, size_t size, void* user_data)
+{
+    context->ep->ops[socket] = (ep_pending_op){ .kind = EP_SEND, .buffer = buffer, .size = size, .user_data = user_data };
+    ep_try(context, socket);
+}
+
+// completes like IORING_OP_ASYNC_CANCEL: the target with -ECANCELED, the cancel with 0 or -ENOENT
+void ep_cancel(ur_thread_context* context, io_connection_data* target, void* user_data)
+{
+    ur_epoll_context* ep = context->ep;
+    ep_pending_op* op = &ep->ops[target->socket];
+
+    if (op->kind != EP_NONE && op->user_data == target) {
+        ep_complete(ep, target->socket, -ECANCELED);
+        ep_post(ep, user_data, 0);
+    }
+    else {
+        ep_post(ep, user_data, -ENOENT);
+    }
+}
+
+ur_backend epoll_backend = { "epoll", ep_setup, ep_wait, ep_seen, ep_accept, ep_recv, ep_send, ep_cancel };
+
+
+void* launch_uring(void *arg) {
+
+    int sock_listen = ((int*)arg)[0];
+    int thread_num = ((int*)arg)[1]; 
+
+    cpu_set_t cpuset;
+    pthread_t thread;
+
+    thread = pthread_self();
+    CPU_ZERO(&cpuset);
+    CPU_SET(thread_num % sysconf(_SC_NPROCESSORS_ONLN), &cpuset);
+
+    int res = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+    if (res != 0) {
+       perror("pthread_setaffinity_np failed. \n");
+       return NULL;
+    }
+
+    struct sockaddr_in cli_addr;
+    ur_thread_context* context;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+
+    context = malloc(sizeof(ur_thread_context));
+    memset(context, 0, sizeof(ur_thread_context));
+    context->control_op.state = CONTROL;
+    context->cancel_op.state = CANCEL;
+    context->migrate_op.state = MIGRATE_IN;
+    context->ring_eventfd = -1;
+    context->host_epoll = -1;
+
+    if (server_config.udp) {
+        context->dgram = malloc(sizeof(ur_datagram_context));
+        memset(context->dgram, 0, sizeof(ur_datagram_context));
+    }
+    else if (server_config.splice_threshold) {
+        context->splice_pool = calloc(CONNECTIONS_POOL_SIZE, sizeof(io_splice_connection));
+        for (int i = 0; i < CONNECTIONS_POOL_SIZE; i++) {
+            context->splice_pool[i].pipe[0] = context->splice_pool[i].pipe[1] = -1;
+        }
+    }
+
+    memset(&cli_addr, 0, addr_len);
+    
+
+
+    context->stats = &thread_stats[thread_num];
+
+    if (backend->setup(context, thread_num, &cpuset) < 0) {
+        context_free(context);
+        return NULL;
+    }
+
+    ur_thread_stats* stats = context->stats;
+
+
+    if (server_config.udp) {
+        // post the initial batch of receives on this thread's UDP socket
+        datagram_start(context, sock_listen);
+    }
+    else {
+        // add 1st accept sqe
+        io_accept(context, sock_listen, (struct sockaddr *)&cli_addr, &addr_len);
+
+        // unix sockets use the same buffers and ring, peer address isn't needed
+        for (int i = 0; i < server_config.unix_listeners_count; i++) {
+            io_accept(context, server_config.unix_listeners[i], NULL, NULL);
+        }
+    }
+
+    if (server_config.elastic_max) {
+        io_control_read(context, thread_slots[thread_num].control_fd);
+        __atomic_store_n(&thread_slots[thread_num].context, context, __ATOMIC_RELEASE);
+    }
+
+
+
+    // main io loop, only a retired elastic thread leaves it
+    while (1)
+    {
+        struct io_uring_cqe *cqes[IO_URING_LEN];
+        int total_cqes = backend->wait(context, cqes, IO_URING_LEN);
+
+        stats->wakeups++;
+        stats->cqes += total_cqes;
+
+        // iterate through CQEs
+        for (int i = 0; i < total_cqes; i++)
+        {
+            struct io_uring_cqe *cqe = cqes[i];
+            io_connection_data *cqe_data = (io_connection_data*)io_uring_cqe_get_data(cqe);
+
+
+            switch(cqe_data->state) {
+                case ACCEPT: {
+                    res = cqe->res; //new socket FD
+                    int more = cqe->flags & IORING_CQE_F_MORE;
+
+                    //printf("ACCEPT SOCKET# %i in thread# %i \n", res, thread_num);
+                    //fflush(stdout);
+
+
+                    if (res >= CONNECTIONS_POOL_SIZE || (res > 0 && admission_refuse(context))) {
+                        close(res);
+                        stats->shed++;
+                    }
+                    else if (res > 0) {
+                        if (context->splice_pool) {
+                            memset(&context->splice_pool[res], 0, sizeof(io_splice_connection));
+                            context->splice_pool[res].eligible = cqe_data->socket != server_config.unix_seqpacket_listener;
+                            context->splice_pool[res].pipe[0] = context->splice_pool[res].pipe[1] = -1;
+                        }
+                        context->open[res] = 1;
+                        context->open_count++;
+                        conn_idle(context, res);
+                    }
+
+                    // a multishot accept stays armed until a CQE comes without F_MORE
+                    if (more) {
+                        break;
+                    }
+
+                    // a retiring ring leaves the listeners to the remaining ones, a paused one rearms on resume
+                    context->armed_accepts--;
+                    context->accept_armed[cqe_data->socket] = 0;
+                    if (context->retiring || (context->admission_paused && !server_config.shed)) {
+                        break;
+                    }
+
+                    if (cqe_data->socket == sock_listen) {
+                        io_accept(context, sock_listen, (struct sockaddr *)&cli_addr, &addr_len);
+                    }
+                    else {
+                        io_accept(context, cqe_data->socket, NULL, NULL);
+                    }
+                    break;
+                }
+
+                case READ:
+                    res = cqe->res; //bytes read
+
+                    if (res == -ECANCELED && context->retiring) {
+                       // idle connection pulled back for handover
+                       conn_idle(context, cqe_data->socket);
+                    }
+                    else if (res <= 0) {
+                       //connection was closed
+                       conn_close(context, cqe_data->socket);
+                    }
+                    else {
+                       io_write(context, cqe_data->socket, res);
+                       stats->messages++;
+                       stats->bytes += res;
+                    }
+                    break;
+                case WRITE:
+                    res = cqe->res; //bytes written, same as the read before
+
+
+                    // large payloads go zero-copy from here on, if the pipe can't be had stay on the copy path
+                    if (context->splice_pool && res >= (int)server_config.splice_threshold
+                        && splice_start(context, cqe_data->socket) == 0) {
+                        break;
+                    }
+
+                    // a full read means the payload doesn't fit, continue on a registered buffer if one is free
+                    if (context->zc && res == CLIENT_MESSAGE_SIZE && zc_start(context, cqe_data->socket) == 0) {
+                        break;
+                    }
+                    conn_idle(context, cqe_data->socket);
+                    break;
+
+                case RECVMSG:
+                case SENDMSG:
+                case PROVIDE_BUFFER:
+                    datagram_complete(context, cqe, cqe_data, stats);
+                    break;
+
+                case SPLICE_POLL:
+                case SPLICE_IN:
+                case SPLICE_OUT:
+                    splice_complete(context, cqe, cqe_data, stats);
+                    break;
+
+                case ZC_READ:
+                case ZC_WRITE:
+                case ZC_SEND:
+                    zc_complete(context, cqe, cqe_data, stats);
+                    break;
+
+                case CONTROL:
+
+                    if (__atomic_load_n(&thread_slots[thread_num].retire, __ATOMIC_ACQUIRE)) {
+                        elastic_retire(context, sock_listen);
+                    }
+                    else {
+                        io_control_read(context, thread_slots[thread_num].control_fd);
+                    }
+                    break;
+
+                case CANCEL:
+                    context->pending_control--;
+                    break;
+
+                case MIGRATE_OUT:
+                    res = cqe->res;
+                    context->pending_control--;
+
+                    if (res < 0) {
+                        printf("handing over socket# %i failed: %s \n", cqe_data->socket, strerror(-res));
+                        close(cqe_data->socket);
+                    }
+                    break;
+
+                case MIGRATE_IN:
+                    res = cqe->res; //socket handed over by a retiring ring
+
+                    context->open[res] = 1;
+                    context->open_count++;
+                    conn_idle(context, res);
+                    break;
+            }
+        }
+
+        backend->seen(context, total_cqes);
+
+        if (server_config.max_conns || server_config.max_backlog) {
+            admission_update(context, total_cqes, sock_listen, (struct sockaddr *)&cli_addr, &addr_len);
+        }
+
+        // retired: listeners canceled, connections handed over, nothing left in flight
+        if (context->retiring && !context->armed_accepts && !context->open_count && !context->pending_control) {
+            break;
+        }
+    }
+
+    ur_thread_slot* slot = &thread_slots[thread_num];
+
+    __atomic_store_n(&slot->context, NULL, __ATOMIC_RELEASE);
+    io_uring_queue_exit(&context->uring);
+    context_free(context);
+    __atomic_store_n(&slot->state, SLOT_EXITED, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// releases what a ring thread set up next to its ring, the ring itself is exited by the caller
+void context_free(ur_thread_context* context)
+{
+    if (context->zc) {
+        munmap(context->zc->memory, (size_t)ZC_POOL_SIZE * ZC_BUFFER_SIZE);
+        free(context->zc);
+    }
+
+    if (context->splice_pool) {
+        for (int i = 0; i < CONNECTIONS_POOL_SIZE; i++) {
+            if (context->splice_pool[i].pipe[0] >= 0) {
+                close(context->splice_pool[i].pipe[0]);
+                close(context->splice_pool[i].pipe[1]);
+            }
+        }
+        free(context->splice_pool);
+    }
+
+    free(context->dgram);
+
+    if (context->ep) {
+        close(context->ep->epoll_fd);
+        free(context->ep);
+    }
+
+    if (context->ring_eventfd >= 0) {
+        close(context->ring_eventfd);
+    }
+    if (context->host_epoll >= 0) {
+        close(context->host_epoll);
+    }
+
+    free(context);
+}
+
+
+void io_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len)
+{
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = ACCEPT;
+
+    backend->accept(context, socket, cli_addr, addr_len, conn_data);
+    context->accept_armed[socket] = 1;
+    context->armed_accepts++;
+}
+
+void io_read(ur_thread_context* context, int socket, size_t size)
+{
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = READ;
+
+    backend->recv(context, socket, &context->messages_buffer[socket], size, conn_data);
+}
+
+void io_write(ur_thread_context* context, int socket, size_t size)
+{
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = WRITE;
+
+    backend->send(context, socket, &context->messages_buffer[socket], size, conn_data);
+}
+
+
+// connection waits for its next request, on a retiring ring it moves to another one instead
+void conn_idle(ur_thread_context* context, int socket)
+{
+    if (context->retiring && elastic_migrate(context, socket) == 0) {
+        return;
+    }
+    io_read(context, socket, CLIENT_MESSAGE_SIZE);
+}
+
+void conn_close(ur_thread_context* context, int socket)
+{
+    context->open[socket] = 0;
+    context->open_count--;
+    close(socket);
+}
+
+// accepts completing past the connection cap, multishot or in flight before a pause, are shed
+int admission_refuse(ur_thread_context* context)
+{
+    if (server_config.max_conns && context->open_count >= server_config.max_conns) {
+        return 1;
+    }
+    return server_config.shed && context->admission_paused;
+}
+
+// once per wakeup: pause accepting at a limit, resume under ADMISSION_RESUME of all of them
+void admission_update(ur_thread_context* context, unsigned backlog, int sock_listen, struct sockaddr *cli_addr, socklen_t *addr_len)
+{
+    unsigned conns = context->open_count;
+
+    if (!context->admission_paused) {
+        if ((server_config.max_conns && conns >= server_config.max_conns)
+            || (server_config.max_backlog && backlog >= server_config.max_backlog)) {
+            context->admission_paused = 1;
+            context->stats->pauses++;
+            context->stats->paused = 1;
+
+            // multishot accepts stay armed until canceled. shedding keeps them to close what comes in
+            if (!server_config.shed && !context->retiring) {
+                if (context->accept_armed[sock_listen]) {
+                    io_cancel(context, &context->conn_pool[sock_listen]);
+                }
+                for (int i = 0; i < server_config.unix_listeners_count; i++) {
+                    if (context->accept_armed[server_config.unix_listeners[i]]) {
+                        io_cancel(context, &context->conn_pool[server_config.unix_listeners[i]]);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    if ((server_config.max_conns && conns > server_config.max_conns * ADMISSION_RESUME)
+        || (server_config.max_backlog && backlog > server_config.max_backlog * ADMISSION_RESUME)) {
+        return;
+    }
+
+    context->admission_paused = 0;
+    context->stats->paused = 0;
+
+    if (context->retiring) {
+        return;
+    }
+
+    // accepts still being canceled rearm themselves when they complete
+    if (!context->accept_armed[sock_listen]) {
+        io_accept(context, sock_listen, cli_addr, addr_len);
+    }
+    for (int i = 0; i < server_config.unix_listeners_count; i++) {
+        if (!context->accept_armed[server_config.unix_listeners[i]]) {
+            io_accept(context, server_config.unix_listeners[i], NULL, NULL);
+        }
+    }
+}
+
+
+//
+// datagram mode
+//
+
+void io_recvmsg(ur_thread_context* context, int socket, io_datagram_slot* slot)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    slot->iov.iov_base = slot->buffer;
+    slot->iov.iov_len = UDP_MESSAGE_SIZE;
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = sizeof(slot->addr);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    slot->msg.msg_control = slot->control;
+    slot->msg.msg_controllen = sizeof(slot->control);
+    slot->msg.msg_flags = 0;
+
+    io_uring_prep_recvmsg(sqe, socket, &slot->msg, 0);
+
+    slot->op.socket = socket;
+    slot->op.state = RECVMSG;
+
+    io_uring_sqe_set_data(sqe, &slot->op);
+}
+
+void io_recvmsg_multishot(ur_thread_context* context, int socket)
+{
+    ur_datagram_context* dgram = context->dgram;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    // only the sizes matter, the kernel lays out name/control/payload in the selected buffer
+    memset(&dgram->multishot_msg, 0, sizeof(dgram->multishot_msg));
+    dgram->multishot_msg.msg_namelen = sizeof(struct sockaddr_in6);
+    dgram->multishot_msg.msg_controllen = UDP_CONTROL_SIZE;
+
+    io_uring_prep_recvmsg_multishot(sqe, socket, &dgram->multishot_msg, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+    sqe->buf_group = UDP_BUFFER_GROUP;
+
+    dgram->multishot_op.socket = socket;
+    dgram->multishot_op.state = RECVMSG;
+    dgram->multishot_armed = 1;
+
+    io_uring_sqe_set_data(sqe, &dgram->multishot_op);
+}
+
+void io_sendmsg(ur_thread_context* context, int socket, io_datagram_slot* slot, void* name, socklen_t name_len, void* data, size_t size, int gso_size)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    // name may point into slot->addr or into the provided buffer, both stay untouched until completion
+    slot->iov.iov_base = data;
+    slot->iov.iov_len = size;
+    slot->msg.msg_name = name;
+    slot->msg.msg_namelen = name_len;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    slot->msg.msg_control = NULL;
+    slot->msg.msg_controllen = 0;
+    slot->msg.msg_flags = 0;
+
+    // echo a GRO coalesced datagram back as one GSO send with the same segment size
+    if (gso_size > 0 && size > (size_t)gso_size) {
+        struct cmsghdr *cm;
+
+        memset(slot->control, 0, sizeof(slot->control));
+        slot->msg.msg_control = slot->control;
+        slot->msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+        cm = CMSG_FIRSTHDR(&slot->msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *((uint16_t *)CMSG_DATA(cm)) = gso_size;
+    }
+
+    io_uring_prep_sendmsg(sqe, socket, &slot->msg, 0);
+
+    slot->op.socket = socket;
+    slot->op.state = SENDMSG;
+
+    io_uring_sqe_set_data(sqe, &slot->op);
+}
+
+void io_provide_buffer(ur_thread_context* context, io_datagram_slot* slot)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    io_uring_prep_provide_buffers(sqe, slot->buffer, sizeof(slot->buffer), 1, UDP_BUFFER_GROUP, slot->index);
+
+    slot->op.state = PROVIDE_BUFFER;
+
+    io_uring_sqe_set_data(sqe, &slot->op);
+}
+
+// returns UDP_GRO segment size of a received datagram or 0 if it was not coalesced
+static int datagram_gro_size(struct cmsghdr *cm)
+{
+    if (cm && cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+        int gso_size;
+        memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+        return gso_size;
+    }
+    return 0;
+}
+
+void datagram_start(ur_thread_context* context, int socket)
+{
+    ur_datagram_context* dgram = context->dgram;
+
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        dgram->slots[i].index = i;
+        dgram->slots[i].op.socket = socket;
+    }
+
+    dgram->multishot = features[FEAT_MULTISHOT_RECV].enabled;
+
+    if (dgram->multishot) {
+        // hand all slot buffers to the kernel, one multishot recvmsg picks from them
+        for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+            io_provide_buffer(context, &dgram->slots[i]);
+        }
+        io_recvmsg_multishot(context, socket);
+    }
+    else {
+        for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+            io_recvmsg(context, socket, &dgram->slots[i]);
+        }
+    }
+}
+
+void datagram_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats)
+{
+    ur_datagram_context* dgram = context->dgram;
+    int res = cqe->res;
+
+    if (cqe_data == &dgram->multishot_op) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            dgram->multishot_armed = 0;
+        }
+
+        if (res == -EINVAL || res == -EOPNOTSUPP) {
+            // kernel without multishot recvmsg (< 6.0). provided buffers are simply never selected
+            printf("multishot recvmsg not supported, using batched recvmsg \n");
+            dgram->multishot = 0;
+            for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+                io_recvmsg(context, cqe_data->socket, &dgram->slots[i]);
+            }
+            return;
+        }
+
+        if (res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            io_datagram_slot* slot = &dgram->slots[cqe->flags >> IORING_CQE_BUFFER_SHIFT];
+            struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(slot->buffer, res, &dgram->multishot_msg);
+
+            if (out == NULL || out->namelen > dgram->multishot_msg.msg_namelen) {
+                io_provide_buffer(context, slot);
+            }
+            else {
+                int gso_size = datagram_gro_size(io_uring_recvmsg_cmsg_firsthdr(out, &dgram->multishot_msg));
+                unsigned size = io_uring_recvmsg_payload_length(out, res, &dgram->multishot_msg);
+                io_sendmsg(context, cqe_data->socket, slot,
+                           io_uring_recvmsg_name(out), out->namelen,
+                           io_uring_recvmsg_payload(out, &dgram->multishot_msg), size,
+                           gso_size);
+                stats->messages++;
+                stats->bytes += size;
+            }
+        }
+
+        // -ENOBUFS: every buffer is in flight, re-armed once one comes back
+        if (!dgram->multishot_armed && res != -ENOBUFS) {
+            io_recvmsg_multishot(context, cqe_data->socket);
+        }
+        return;
+    }
+
+    io_datagram_slot* slot = (io_datagram_slot*)cqe_data;
+
+    switch (cqe_data->state) {
+        case RECVMSG:
+            if (res < 0) {
+                io_recvmsg(context, cqe_data->socket, slot);
+            }
+            else {
+                int gso_size = datagram_gro_size(slot->msg.msg_controllen ? CMSG_FIRSTHDR(&slot->msg) : NULL);
+                io_sendmsg(context, cqe_data->socket, slot, &slot->addr, slot->msg.msg_namelen, slot->buffer, res, gso_size);
+                stats->messages++;
+                stats->bytes += res;
+            }
+            break;
+
+        case SENDMSG:
+            // datagram is gone, the buffer can take the next one
+            if (dgram->multishot) {
+                io_provide_buffer(context, slot);
+            }
+            else {
+                io_recvmsg(context, cqe_data->socket, slot);
+            }
+            break;
+
+        case PROVIDE_BUFFER:
+            if (dgram->multishot && !dgram->multishot_armed) {
+                io_recvmsg_multishot(context, cqe_data->socket);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+//
+// splice mode
+//
+
+int splice_start(ur_thread_context* context, int socket)
+{
+    io_splice_connection* conn = &context->splice_pool[socket];
+
+    if (!conn->eligible || pipe(conn->pipe) < 0) {
+        conn->pipe[0] = conn->pipe[1] = -1;
+        return -1;
+    }
+
+    io_splice_arm(context, socket);
+    return 0;
+}
+
+void io_splice_arm(ur_thread_context* context, int socket)
+{
+    io_splice_connection* conn = &context->splice_pool[socket];
+    struct io_uring_sqe *sqe;
+
+    // splice always runs in an io-wq worker, wait for data first so an idle socket doesn't hold one
+    sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_poll_add(sqe, socket, POLLIN);
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+    conn->poll_op.socket = socket;
+    conn->poll_op.state = SPLICE_POLL;
+    io_uring_sqe_set_data(sqe, &conn->poll_op);
+
+    sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_splice(sqe, socket, -1, conn->pipe[1], -1, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+    conn->in_op.socket = socket;
+    conn->in_op.state = SPLICE_IN;
+    io_uring_sqe_set_data(sqe, &conn->in_op);
+
+    // a short splice in breaks the link, this one then completes with -ECANCELED and is reissued with the exact length
+    io_splice_out(context, socket, SPLICE_CHUNK);
+}
+
+void io_splice_out(ur_thread_context* context, int socket, unsigned size)
+{
+    io_splice_connection* conn = &context->splice_pool[socket];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    io_uring_prep_splice(sqe, conn->pipe[0], -1, socket, -1, size, SPLICE_F_MOVE);
+
+    conn->out_op.socket = socket;
+    conn->out_op.state = SPLICE_OUT;
+    io_uring_sqe_set_data(sqe, &conn->out_op);
+}
+
+// the out splice is always the last CQE of a chain, all decisions are made there
+void splice_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats)
+{
+    io_splice_connection* conn = &context->splice_pool[cqe_data->socket];
+    int res = cqe->res;
+
+    switch (cqe_data->state) {
+        case SPLICE_IN:
+            if (res > 0) {
+                conn->pending += res;
+                stats->messages++;
+                stats->bytes += res;
+            }
+            else if (res != -EAGAIN) {
+                // connection closed, or the poll failed and took the chain down
+                conn->closing = 1;
+            }
+            break;
+
+        case SPLICE_OUT:
+            if (res > 0) {
+                conn->pending -= res;
+            }
+            else if (res != -ECANCELED) {
+                conn->closing = 1;
+            }
+
+            if (conn->closing) {
+                close(conn->pipe[0]);
+                close(conn->pipe[1]);
+                conn->pipe[0] = conn->pipe[1] = -1;
+                conn_close(context, cqe_data->socket);
+            }
+            else if (conn->pending > 0) {
+                io_splice_out(context, cqe_data->socket, conn->pending);
+            }
+            else {
+                io_splice_arm(context, cqe_data->socket);
+            }
+            break;
+
+        default:
+            // the splice in reports what the poll found
+            break;
+    }
+}
+
+
+//
+// zero-copy send mode
+//
+
+// allocates and registers this ring's buffer pool, NULL if the kernel refuses the registration
+ur_zc_context* zc_setup(struct io_uring* uring)
+{
+    ur_zc_context* zc = malloc(sizeof(ur_zc_context));
+    struct iovec iov[ZC_POOL_SIZE];
+
+    zc->memory = mmap(NULL, (size_t)ZC_POOL_SIZE * ZC_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (zc->memory == MAP_FAILED) {
+        perror("mmap failed for zero-copy buffers \n");
+        free(zc);
+        return NULL;
+    }
+
+    for (int i = 0; i < ZC_POOL_SIZE; i++) {
+        iov[i].iov_base = zc->memory + (size_t)i * ZC_BUFFER_SIZE;
+        iov[i].iov_len = ZC_BUFFER_SIZE;
+        zc->buffers[i].index = i;
+        zc->buffers[i].op.state = ZC_SEND;
+        zc->free[i] = i;
+    }
+    zc->free_count = ZC_POOL_SIZE;
+
+    int res = io_uring_register_buffers(uring, iov, ZC_POOL_SIZE);
+    if (res < 0) {
+        // RLIMIT_MEMLOCK on kernels that still charge registered buffers against it
+        printf("registering zero-copy buffers failed: %s. zero-copy send disabled \n", strerror(-res));
+        munmap(zc->memory, (size_t)ZC_POOL_SIZE * ZC_BUFFER_SIZE);
+        free(zc);
+        return NULL;
+    }
+    return zc;
+}
+
+int zc_start(ur_thread_context* context, int socket)
+{
+    ur_zc_context* zc = context->zc;
+
+    if (zc->free_count == 0) {
+        return -1;
+    }
+
+    zc->conn_buffer[socket] = zc->free[--zc->free_count];
+    io_zc_read(context, socket);
+    return 0;
+}
+
+void io_zc_read(ur_thread_context* context, int socket)
+{
+    ur_zc_context* zc = context->zc;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    char* buffer = zc->memory + (size_t)zc->conn_buffer[socket] * ZC_BUFFER_SIZE;
+
+    io_uring_prep_recv(sqe, socket, buffer, ZC_BUFFER_SIZE, 0);
+
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = ZC_READ;
+
+    io_uring_sqe_set_data(sqe, conn_data);
+}
+
+// plain send out of the registered buffer, it's reusable as soon as this completes. MSG_WAITALL has
+// the kernel retry a partial send with the rest, a result short of size only comes with an error
+void io_zc_write(ur_thread_context* context, int socket, size_t size)
+{
+    ur_zc_context* zc = context->zc;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    char* buffer = zc->memory + (size_t)zc->conn_buffer[socket] * ZC_BUFFER_SIZE;
+
+    io_uring_prep_send(sqe, socket, buffer, size, MSG_WAITALL);
+
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = ZC_WRITE;
+
+    io_uring_sqe_set_data(sqe, conn_data);
+}
+
+void io_zc_send(ur_thread_context* context, int socket, unsigned buffer, size_t size)
+{
+    ur_zc_context* zc = context->zc;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+
+    io_uring_prep_send_zc_fixed(sqe, socket, zc->memory + (size_t)buffer * ZC_BUFFER_SIZE, size, MSG_WAITALL, 0, buffer);
+
+    // both the send result and the notification carry the buffer as user data
+    zc->buffers[buffer].op.socket = socket;
+    io_uring_sqe_set_data(sqe, &zc->buffers[buffer].op);
+}
+
+void zc_complete(ur_thread_context* context, struct io_uring_cqe* cqe, io_connection_data* cqe_data, ur_thread_stats* stats)
+{
+    ur_zc_context* zc = context->zc;
+    int socket = cqe_data->socket;
+    int res = cqe->res;
+
+    switch (cqe_data->state) {
+        case ZC_READ:
+            if (res <= 0) {
+                zc->free[zc->free_count++] = zc->conn_buffer[socket];
+                conn_close(context, socket);
+                break;
+            }
+
+            stats->messages++;
+            stats->bytes += res;
+
+            if (res >= (int)server_config.zc_threshold && zc->free_count > 0) {
+                // the sent buffer is pinned until its notification, receive into a fresh one meanwhile
+                unsigned sent = zc->conn_buffer[socket];
+                zc->conn_buffer[socket] = zc->free[--zc->free_count];
+                io_zc_send(context, socket, sent, res);
+            }
+            else {
+                io_zc_write(context, socket, res);
+            }
+            break;
+
+        case ZC_WRITE:
+            if (res < 0) {
+                zc->free[zc->free_count++] = zc->conn_buffer[socket];
+                conn_close(context, socket);
+                break;
+            }
+            io_zc_read(context, socket);
+            break;
+
+        case ZC_SEND: {
+            io_zc_buffer* buffer = (io_zc_buffer*)cqe_data;
+
+            if (cqe->flags & IORING_CQE_F_NOTIF) {
+                zc->free[zc->free_count++] = buffer->index;
+                break;
+            }
+
+            // without F_MORE the send failed before pinning anything, no notification follows
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                zc->free[zc->free_count++] = buffer->index;
+            }
+            if (res < 0) {
+                zc->free[zc->free_count++] = zc->conn_buffer[socket];
+                conn_close(context, socket);
+                break;
+            }
+            io_zc_read(context, socket);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+//
+// elastic thread pool
+//
+
+void io_control_read(ur_thread_context* context, int fd)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_read(sqe, fd, &context->control_value, sizeof(context->control_value), 0);
+
+    context->control_op.socket = fd;
+    io_uring_sqe_set_data(sqe, &context->control_op);
+}
+
+void io_cancel(ur_thread_context* context, io_connection_data* target)
+{
+    backend->cancel(context, target, &context->cancel_op);
+    context->pending_control++;
+}
+
+// stop accepting and pull idle connections back for handover, busy ones follow once their write completes
+void elastic_retire(ur_thread_context* context, int sock_listen)
+{
+    context->retiring = 1;
+
+    io_cancel(context, &context->conn_pool[sock_listen]);
+    for (int i = 0; i < server_config.unix_listeners_count; i++) {
+        io_cancel(context, &context->conn_pool[server_config.unix_listeners[i]]);
+    }
+
+    // without MSG_RING connections can't move, the ring drains until its clients disconnect
+    if (!features[FEAT_MSG_RING].enabled) {
+        return;
+    }
+
+    for (int fd = 0; fd < CONNECTIONS_POOL_SIZE; fd++) {
+        if (context->open[fd] && context->conn_pool[fd].state == READ) {
+            io_cancel(context, &context->conn_pool[fd]);
+        }
+    }
+}
+
+// round robin over rings that aren't retiring
+static ur_thread_context* migrate_target(ur_thread_context* context)
+{
+    for (int n = 0; n < MAX_THREADS; n++) {
+        unsigned i = (context->next_target + n) % MAX_THREADS;
+        ur_thread_context* target = __atomic_load_n(&thread_slots[i].context, __ATOMIC_ACQUIRE);
+
+        if (target && target != context && !__atomic_load_n(&thread_slots[i].retire, __ATOMIC_ACQUIRE)) {
+            context->next_target = i + 1;
+            return target;
+        }
+    }
+    return NULL;
+}
+
+// posts the socket to another ring as a MSG_RING CQE, the connection isn't ours from here on
+int elastic_migrate(ur_thread_context* context, int socket)
+{
+    ur_thread_context* target = features[FEAT_MSG_RING].enabled ? migrate_target(context) : NULL;
+
+    if (target == NULL) {
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
+    io_uring_prep_msg_ring(sqe, target->uring.ring_fd, socket, (uint64_t)(uintptr_t)&target->migrate_op, 0);
+
+    io_connection_data *conn_data = &context->conn_pool[socket];
+    conn_data->socket = socket;
+    conn_data->state = MIGRATE_OUT;
+    io_uring_sqe_set_data(sqe, conn_data);
+
+    context->open[socket] = 0;
+    context->open_count--;
+    context->pending_control++;
+    return 0;
+}
+
+void elastic_spawn(thread_params* tp)
+{
+    ur_thread_slot* slot = &thread_slots[tp->thread_num];
+
+    slot->control_fd = eventfd(0, 0);
+    slot->retire = 0;
+    slot->cpu = 0;
+    slot->context = NULL;
+    slot->state = SLOT_RUNNING;
+
+    pthread_create(&slot->tid, NULL, &launch_uring, (void*)tp);
+}
+
+// grows the ring thread pool while the rings are busy and shrinks it when they idle, never returns
+void launch_elastic(thread_params* tp_arr)
+{
+    unsigned busy = 0, idle = 0;
+    int retiring = -1;
+
+    for (unsigned i = 0; i < server_config.elastic_min; i++) {
+        elastic_spawn(&tp_arr[i]);
+    }
+
+    while (1) {
+        sleep(ELASTIC_INTERVAL);
+
+        double load = 0;
+        unsigned running = 0;
+        int last = -1, first_free = -1;
+
+        for (unsigned i = 0; i < server_config.elastic_max; i++) {
+            ur_thread_slot* slot = &thread_slots[i];
+            int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+            if (state == SLOT_EXITED) {
+                pthread_join(slot->tid, NULL);
+                close(slot->control_fd);
+                slot->state = state = SLOT_FREE;
+                retiring = -1;
+                __atomic_add_fetch(&elastic_retired, 1, __ATOMIC_RELAXED);
+                printf("elastic: ring thread# %u retired \n", i);
+            }
+
+            if (state == SLOT_FREE) {
+                if (first_free < 0) {
+                    first_free = i;
+                }
+                continue;
+            }
+
+            if (slot->retire) {
+                continue;
+            }
+
+            // utilization is the share of the interval the thread spent on CPU instead of waiting
+            clockid_t clock;
+            struct timespec ts;
+            double cpu = slot->cpu;
+
+            if (pthread_getcpuclockid(slot->tid, &clock) == 0 && clock_gettime(clock, &ts) == 0) {
+                cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+            }
+            load += (cpu - slot->cpu) / ELASTIC_INTERVAL;
+            slot->cpu = cpu;
+            running++;
+            last = i;
+        }
+
+        double utilization = running ? load / running : 0;
+
+        busy = utilization > ELASTIC_HIGH ? busy + 1 : 0;
+        idle = utilization < ELASTIC_LOW ? idle + 1 : 0;
+
+        if (busy >= ELASTIC_PATIENCE && running < server_config.elastic_max && first_free >= 0) {
+            elastic_spawn(&tp_arr[first_free]);
+            __atomic_add_fetch(&elastic_added, 1, __ATOMIC_RELAXED);
+            printf("elastic: utilization %.0f%%, ring thread# %i added \n", utilization * 100, first_free);
+            busy = 0;
+        }
+        else if (idle >= ELASTIC_PATIENCE && running > server_config.elastic_min && retiring < 0) {
+            ur_thread_slot* slot = &thread_slots[last];
+            uint64_t wake = 1;
+
+            __atomic_store_n(&slot->retire, 1, __ATOMIC_RELEASE);
+            if (write(slot->control_fd, &wake, sizeof(wake)) < 0) {
+                perror("waking ring thread failed \n");
+            }
+            retiring = last;
+            printf("elastic: utilization %.0f%%, retiring ring thread# %i \n", utilization * 100, last);
+            idle = 0;
+        }
+        fflush(stdout);
+    }
+}
+
+
+//
+// prefork mode
+//
+
+pid_t prefork_worker(thread_params* tp)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        // same ring loop as a ring thread, in its own address space. goes down with the supervisor
+        sigset_t chld;
+
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        launch_uring(tp);
+        exit(1);
+    }
+
+    if (pid < 0) {
+        perror("fork failed \n");
+    }
+    return pid;
+}
+
+// a worker died, it's forked again in its slot
+void prefork_restart(thread_params* tp_arr, long workers, pid_t pid, int status)
+{
+    for (long i = 0; i < workers; i++) {
+        if (worker_pids[i] != pid) {
+            continue;
+        }
+
+        if (WIFSIGNALED(status)) {
+            printf("worker# %li (pid %i) killed by signal %i, restarting \n", i, pid, WTERMSIG(status));
+        }
+        else {
+            printf("worker# %li (pid %i) exited with %i, restarting \n", i, pid, WEXITSTATUS(status));
+        }
+        fflush(stdout);
+
+        // a worker failing at startup would otherwise be respawned in a tight loop
+        if (WIFEXITED(status)) {
+            sleep(1);
+        }
+
+        __atomic_add_fetch(&worker_restarts, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&worker_pids[i], prefork_worker(&tp_arr[i]), __ATOMIC_RELAXED);
+    }
+}
+
+// whether the monotonic time t has come
+static int time_reached(struct timespec* t, struct timespec* now)
+{
+    return now->tv_sec > t->tv_sec || (now->tv_sec == t->tv_sec && now->tv_nsec >= t->tv_nsec);
+}
+
+// forks the workers and restarts the ones that die, never returns. the supervisor stays single
+// threaded so no fork can catch another thread holding a lock, stdio's included: the stats are
+// printed from this loop, which waits for SIGCHLD with the time left to the next sample or retry.
+// a slot whose fork failed keeps pid -1 and is forked again PREFORK_RETRY_SEC later
+void launch_prefork(thread_params* tp_arr, long workers)
+{
+    ur_stats_sampler stats;
+    struct timespec next_stats, next_retry, now;
+    sigset_t chld;
+    int unforked = 0;
+
+    // blocked, SIGCHLD stays pending for sigtimedwait() instead of being discarded
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+
+    for (long i = 0; i < workers; i++) {
+        __atomic_store_n(&worker_pids[i], prefork_worker(&tp_arr[i]), __ATOMIC_RELAXED);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    next_stats = next_retry = now;
+    next_stats.tv_sec += server_config.stats_interval;
+    next_retry.tv_sec += PREFORK_RETRY_SEC;
+
+    if (server_config.stats_interval) {
+        stats_begin(&stats, workers);
+    }
+
+    while (1) {
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            prefork_restart(tp_arr, workers, pid, status);
+        }
+        if (pid < 0 && errno != EINTR && errno != ECHILD) {
+            perror("waitpid failed \n");
+            sleep(1);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // a fork that failed, at the start or on a restart, is tried again on the retry tick
+        if (time_reached(&next_retry, &now)) {
+            unforked = 0;
+            for (long i = 0; i < workers; i++) {
+                if (worker_pids[i] > 0) {
+                    continue;
+                }
+                __atomic_store_n(&worker_pids[i], prefork_worker(&tp_arr[i]), __ATOMIC_RELAXED);
+                if (worker_pids[i] > 0) {
+                    printf("worker# %li forked again (pid %i) \n", i, worker_pids[i]);
+                    fflush(stdout);
+                } else {
+                    unforked++;
+                }
+            }
+            next_retry = now;
+            next_retry.tv_sec += PREFORK_RETRY_SEC;
+        }
+        else if (!unforked) {
+            for (long i = 0; i < workers; i++) {
+                unforked += worker_pids[i] <= 0;
+            }
+            if (unforked) {
+                next_retry = now;
+                next_retry.tv_sec += PREFORK_RETRY_SEC;
+            }
+        }
+
+        if (server_config.stats_interval && time_reached(&next_stats, &now)) {
+            stats_print(&stats);
+            next_stats = now;
+            next_stats.tv_sec += server_config.stats_interval;
+        }
+
+        // sleep until a worker dies, or the sooner of the next sample and the next retry
+        struct timespec* wake = unforked ? &next_retry : NULL;
+        if (server_config.stats_interval && (wake == NULL || !time_reached(&next_stats, wake))) {
+            wake = &next_stats;
+        }
+
+        if (wake == NULL) {
+            sigwaitinfo(&chld, NULL);
+            continue;
+        }
+
+        struct timespec timeout = { wake->tv_sec - now.tv_sec, wake->tv_nsec - now.tv_nsec };
+        if (timeout.tv_nsec < 0) {
+            timeout.tv_sec--;
+            timeout.tv_nsec += 1000000000;
+        }
+        if (timeout.tv_sec >= 0) {
+            sigtimedwait(&chld, NULL, &timeout);
+        }
+    }
+}
+
+//
+// stats
+//
+
+static double timeval_sec(struct timeval* tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// io-wq workers (5.12+) are threads of the ring's process named iou-wrk-<tid>, pid 0 = this process
+static int iowq_workers(pid_t pid)
+{
+    struct dirent* entry;
+    char path[300], comm[32];
+    int count = 0;
+
+    if (pid) {
+        snprintf(path, sizeof(path), "/proc/%i/task", pid);
+    }
+    else {
+        strcpy(path, "/proc/self/task");
+    }
+
+    DIR* dir = opendir(path);
+
+    if (dir == NULL) {
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        if (pid) {
+            snprintf(path, sizeof(path), "/proc/%i/task/%s/comm", pid, entry->d_name);
+        }
+        else {
+            snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+        }
+        FILE* f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        if (fgets(comm, sizeof(comm), f) && strncmp(comm, "iou-wrk-", 8) == 0) {
+            count++;
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return count;
+}
+
+// CPU seconds and context switches of a live worker process
+static void worker_usage(pid_t pid, double* cpu, long* switches)
+{
+    char path[64], line[256];
+    FILE* f;
+
+    snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+    if ((f = fopen(path, "r")) != NULL) {
+        unsigned long utime, stime;
+
+        // utime and stime are fields 14 and 15, counted after the ")" closing the command name
+        if (fgets(line, sizeof(line), f) && strrchr(line, ')')
+            && sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            *cpu += (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+        fclose(f);
+    }
+
+    snprintf(path, sizeof(path), "/proc/%i/status", pid);
+    if ((f = fopen(path, "r")) != NULL) {
+        long count;
+
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "voluntary_ctxt_switches: %ld", &count) == 1
+                || sscanf(line, "nonvoluntary_ctxt_switches: %ld", &count) == 1) {
+                *switches += count;
+            }
+        }
+        fclose(f);
+    }
+}
+
+// CPU seconds and context switches of the whole server, workers included in prefork mode
+static void server_usage(double* cpu, long* switches)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    *cpu = timeval_sec(&usage.ru_utime) + timeval_sec(&usage.ru_stime);
+    *switches = usage.ru_nvcsw + usage.ru_nivcsw;
+
+    if (server_config.prefork) {
+        // restarted workers were reaped and count as children, the running ones are read from procfs
+        getrusage(RUSAGE_CHILDREN, &usage);
+        *cpu += timeval_sec(&usage.ru_utime) + timeval_sec(&usage.ru_stime);
+        *switches += usage.ru_nvcsw + usage.ru_nivcsw;
+
+        for (unsigned i = 0; i < server_config.prefork; i++) {
+            pid_t pid = __atomic_load_n(&worker_pids[i], __ATOMIC_RELAXED);
+
+            // -1 while a failed fork waits for its retry
+            if (pid > 0) {
+                worker_usage(pid, cpu, switches);
+            }
+        }
+    }
+}
 
+void stats_begin(ur_stats_sampler* sampler, long threads)
+{
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->threads = threads;
+    server_usage(&sampler->prev_cpu, &sampler->prev_switches);
+    clock_gettime(CLOCK_MONOTONIC, &sampler->prev_ts);
+}
 
-void io_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len);
-void io_read(ur_thread_context* context, int socket, size_t size);
-void io_write(ur_thread_context* context, int socket, size_t size);
+// prints the server wide rates since the last sample
+void stats_print(ur_stats_sampler* sampler)
+{
+    ur_thread_stats cur;
+    double cpu_total;
+    long switches_total;
+    struct timespec ts;
+
+    memset(&cur, 0, sizeof(cur));
+    for (long i = 0; i < sampler->threads; i++) {
+        cur.messages += __atomic_load_n(&thread_stats[i].messages, __ATOMIC_RELAXED);
+        cur.bytes += __atomic_load_n(&thread_stats[i].bytes, __ATOMIC_RELAXED);
+        cur.wakeups += __atomic_load_n(&thread_stats[i].wakeups, __ATOMIC_RELAXED);
+        cur.cqes += __atomic_load_n(&thread_stats[i].cqes, __ATOMIC_RELAXED);
+        cur.spin_hits += __atomic_load_n(&thread_stats[i].spin_hits, __ATOMIC_RELAXED);
+        cur.eventfd_wakeups += __atomic_load_n(&thread_stats[i].eventfd_wakeups, __ATOMIC_RELAXED);
+        cur.shed += __atomic_load_n(&thread_stats[i].shed, __ATOMIC_RELAXED);
+        cur.pauses += __atomic_load_n(&thread_stats[i].pauses, __ATOMIC_RELAXED);
+        cur.paused += __atomic_load_n(&thread_stats[i].paused, __ATOMIC_RELAXED);
+    }
+    server_usage(&cpu_total, &switches_total);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
+    double elapsed = (ts.tv_sec - sampler->prev_ts.tv_sec) + (ts.tv_nsec - sampler->prev_ts.tv_nsec) / 1e9;
+    double cpu = cpu_total - sampler->prev_cpu;
+    unsigned long wakeups = cur.wakeups - sampler->prev.wakeups;
+    long switches = switches_total - sampler->prev_switches;
 
+    int iowq = 0;
+    if (server_config.prefork) {
+        for (unsigned i = 0; i < server_config.prefork; i++) {
+            pid_t pid = __atomic_load_n(&worker_pids[i], __ATOMIC_RELAXED);
 
-void* launch_uring(void *arg) {
+            if (pid > 0) {
+                iowq += iowq_workers(pid);
+            }
+        }
+    }
+    else {
+        iowq = iowq_workers(0);
+    }
 
-    int sock_listen = ((int*)arg)[0];
-    int thread_num = ((int*)arg)[1]; 
+    unsigned long bytes = cur.bytes - sampler->prev.bytes;
+
+    printf("stats: %.0f msg/s, %.2f MB/s, %.2f cpu s/GB, %.0f wakeups/s, %.1f cqes/wakeup, cpu %.1f%%, %.0f ctx switches/s, %i iowq workers \n",
+           (cur.messages - sampler->prev.messages) / elapsed,
+           bytes / elapsed / 1e6,
+           bytes ? cpu / (bytes / 1e9) : 0.0,
+           wakeups / elapsed,
+           wakeups ? (double)(cur.cqes - sampler->prev.cqes) / wakeups : 0.0,
+           100.0 * cpu / elapsed,
+           switches / elapsed,
+           iowq);
+    if (server_config.elastic_max) {
+        unsigned running = 0;
+        for (unsigned i = 0; i < server_config.elastic_max; i++) {
+            running += __atomic_load_n(&thread_slots[i].state, __ATOMIC_RELAXED) == SLOT_RUNNING;
+        }
+        printf("elastic: %u ring threads, %lu added, %lu retired \n", running,
+               __atomic_load_n(&elastic_added, __ATOMIC_RELAXED), __atomic_load_n(&elastic_retired, __ATOMIC_RELAXED));
+    }
 
-    cpu_set_t cpuset;
-    pthread_t thread;
+    if (server_config.prefork) {
+        printf("prefork: %u workers, %lu restarts \n", server_config.prefork, __atomic_load_n(&worker_restarts, __ATOMIC_RELAXED));
+    }
 
-    thread = pthread_self();
-    CPU_ZERO(&cpuset);
-    CPU_SET(thread_num, &cpuset);
+    if (server_config.spin_usec) {
+        printf("spin: %.1f%% of wakeups without a syscall \n", wakeups ? 100.0 * (cur.spin_hits - sampler->prev.spin_hits) / wakeups : 0.0);
+    }
 
-    int res = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-    if (res != 0) {
-       perror("pthread_setaffinity_np failed. \n");
-       return NULL;
+    if (server_config.max_conns || server_config.max_backlog) {
+        printf("admission: %.0f shed/s, %lu pauses, %lu of %li threads paused, %lu shed total \n",
+               (cur.shed - sampler->prev.shed) / elapsed, cur.pauses, cur.paused, sampler->threads, cur.shed);
     }
 
-    struct io_uring_params p;
-    struct sockaddr_in cli_addr;
-    ur_thread_context* context;
-    socklen_t addr_len = sizeof(struct sockaddr_in);
+    if (backend == &embed_backend) {
+        unsigned long signals = cur.eventfd_wakeups - sampler->prev.eventfd_wakeups;
+        printf("embed: %.0f eventfd wakeups/s, %.1f%% of wakeups without an eventfd signal \n",
+               signals / elapsed, wakeups ? 100.0 * (wakeups - signals) / wakeups : 0.0);
+    }
+    fflush(stdout);
 
-    context = malloc(sizeof(ur_thread_context));
-    memset(context, 0, sizeof(ur_thread_context));
+    sampler->prev = cur;
+    sampler->prev_cpu = cpu_total;
+    sampler->prev_switches = switches_total;
+    sampler->prev_ts = ts;
+}
 
-    memset(&p, 0, sizeof(p));
-    memset(&cli_addr, 0, addr_len);
-    
+// prints server wide rates every stats_interval seconds. prefork mode samples in the supervisor loop instead
+void* launch_stats(void *arg)
+{
+    ur_stats_sampler sampler;
 
+    stats_begin(&sampler, (long)arg);
 
-    //init uring interface
-    if (io_uring_queue_init_params(IO_URING_LEN, &context->uring, &p) < 0) {
-        perror("io_uring_init failed. \n");
-        return NULL;
+    while (1) {
+        sleep(server_config.stats_interval);
+        stats_print(&sampler);
     }
+}
 
-    if (!(p.features & IORING_FEAT_FAST_POLL)) {
-        perror("IORING_FEAT_FAST_POLL not supported. kernel 5.7 needed. \n");
-        return NULL;
+//
+// feature probing
+//
+
+// submits the single prepared SQE and returns its result
+static int probe_sqe(struct io_uring* ring)
+{
+    struct io_uring_cqe* cqe;
+    int res;
+
+    io_uring_submit(ring);
+    if (io_uring_wait_cqe(ring, &cqe) < 0) {
+        return -EIO;
     }
+    res = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    return res;
+}
 
+// fills features[].supported on throwaway rings, then resolves what the server threads use
+int probe_features()
+{
+    struct io_uring ring, trial;
+    struct io_uring_params p;
+    struct io_uring_probe* probe;
+    struct io_uring_sqe* sqe;
+    struct msghdr msg;
+    int fd;
 
-    // add 1st accept sqe
-    io_accept(context, sock_listen, (struct sockaddr *)&cli_addr, &addr_len);
+    memset(&p, 0, sizeof(p));
+    int res = io_uring_queue_init_params(8, &ring, &p);
+    if (res < 0) {
+        // no io_uring at all: old kernel, seccomp or kernel.io_uring_disabled
+        return res;
+    }
 
+    probe = io_uring_get_probe_ring(&ring);
+
+    features[FEAT_EXT_ARG].supported = (p.features & IORING_FEAT_EXT_ARG) != 0;
+    features[FEAT_SEND_ZC].supported = probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+    features[FEAT_MSG_RING].supported = probe && io_uring_opcode_supported(probe, IORING_OP_MSG_RING);
+
+    // multishot flags live in sqe->ioprio. aimed at a non-socket, a kernel that knows the flag
+    // fails the request with -ENOTSOCK, one that doesn't rejects the SQE with -EINVAL
+    fd = open("/dev/null", O_RDONLY);
+
+    sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_multishot_accept(sqe, fd, NULL, NULL, 0);
+    features[FEAT_MULTISHOT_ACCEPT].supported = probe_sqe(&ring) == -ENOTSOCK;
+
+    // recvmsg ignored ioprio before 5.19, IORING_OP_SOCKET tells those kernels apart
+    memset(&msg, 0, sizeof(msg));
+    sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_recvmsg_multishot(sqe, fd, &msg, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+    sqe->buf_group = UDP_BUFFER_GROUP;
+    features[FEAT_MULTISHOT_RECV].supported = probe_sqe(&ring) == -ENOTSOCK
+                                            && probe && io_uring_opcode_supported(probe, IORING_OP_SOCKET);
+    close(fd);
+
+    // IOWQ_MAX_WORKERS (5.15) came after IOWQ_AFF (5.14). zeroes only read back the current limits
+    unsigned limits[2] = { 0, 0 };
+    features[FEAT_IOWQ_LIMITS].supported = io_uring_register_iowq_max_workers(&ring, limits) == 0;
+
+    // an empty one page buffer ring, registered and dropped again
+    void* buf_ring = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring != MAP_FAILED) {
+        struct io_uring_buf_reg reg = { .ring_addr = (unsigned long)buf_ring, .ring_entries = 8, .bgid = UDP_BUFFER_GROUP };
+
+        if (io_uring_register_buf_ring(&ring, &reg, 0) == 0) {
+            features[FEAT_BUFFER_RING].supported = 1;
+            io_uring_unregister_buf_ring(&ring, UDP_BUFFER_GROUP);
+        }
+        munmap(buf_ring, 4096);
+    }
 
+    // sparse direct descriptor table, what accept/open into fixed slots would register
+    if (io_uring_register_files_sparse(&ring, 8) == 0) {
+        features[FEAT_DIRECT_DESCRIPTORS].supported = 1;
+        io_uring_unregister_files(&ring);
+    }
 
-    // main io loop
-    while (1)
-    {
-        io_uring_submit_and_wait(&context->uring, 1);
+    // SQPOLL before 5.11 needs CAP_SYS_ADMIN, EPERM counts as unsupported
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = 10;
+    if (io_uring_queue_init_params(8, &trial, &p) == 0) {
+        features[FEAT_SQPOLL].supported = 1;
+        io_uring_queue_exit(&trial);
+    }
 
-        struct io_uring_cqe *cqes[IO_URING_LEN];
-        int total_cqes = io_uring_peek_batch_cqe(&context->uring, cqes, IO_URING_LEN);
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    if (io_uring_queue_init_params(8, &trial, &p) == 0) {
+        struct io_uring_params resize;
 
-        // iterate through CQEs
-        for (int i = 0; i < total_cqes; i++)
-        {
-            struct io_uring_cqe *cqe = cqes[i];
-            io_connection_data *cqe_data = (io_connection_data*)io_uring_cqe_get_data(cqe);
+        features[FEAT_DEFER_TASKRUN].supported = 1;
 
+        // resizing is limited to DEFER_TASKRUN rings, resize to the same size as the probe
+        memset(&resize, 0, sizeof(resize));
+        resize.sq_entries = p.sq_entries;
+        features[FEAT_RESIZE_RINGS].supported = io_uring_register(trial.ring_fd, IORING_REGISTER_RESIZE_RINGS, &resize, 1) == 0;
 
-            switch(cqe_data->state) {
-                case ACCEPT:
-                    res = cqe->res; //new socket FD
+        io_uring_queue_exit(&trial);
+    }
 
-                    //printf("ACCEPT SOCKET# %i in thread# %i \n", res, thread_num);
-                    //fflush(stdout);
+    if (probe) {
+        free(probe);
+    }
+    io_uring_queue_exit(&ring);
 
-                    io_uring_cqe_seen(&context->uring, cqe);
+    for (int i = 0; i < FEAT_COUNT; i++) {
+        ur_feature_info* f = &features[i];
+        f->enabled = f->supported && f->implemented && (f->override > 0 || (f->override == 0 && f->preferred));
+    }
 
-                    if (res > 0) {
-                        io_read(context, res, CLIENT_MESSAGE_SIZE);
-                    }
+    // the kernel refuses DEFER_TASKRUN on SQPOLL rings
+    if (features[FEAT_SQPOLL].enabled) {
+        features[FEAT_DEFER_TASKRUN].enabled = 0;
+    }
+    return 0;
+}
 
-                    io_accept(context, sock_listen, (struct sockaddr *)&cli_addr, &addr_len);
-                    break;
+// parses a name=on|off override, returns -1 on an unknown feature or value
+int feature_override(const char* arg)
+{
+    const char* value = strchr(arg, '=');
 
-                case READ:
-                    res = cqe->res; //bytes read
+    if (value == NULL) {
+        return -1;
+    }
 
-                    if (res <= 0) {
-                       //connection was closed
-                       io_uring_cqe_seen(&context->uring, cqe);
-                       close(cqe_data->socket);
-                    }
-                    else {
-                       io_uring_cqe_seen(&context->uring, cqe);
-                       io_write(context, cqe_data->socket, res);
-                    }
-                    break;
-                case WRITE:
-                    io_uring_cqe_seen(&context->uring, cqe);
-                    io_read(context, cqe_data->socket, CLIENT_MESSAGE_SIZE);
-                    break;
+    for (int i = 0; i < FEAT_COUNT; i++) {
+        if (strlen(features[i].name) == (size_t)(value - arg) && strncmp(features[i].name, arg, value - arg) == 0) {
+            if (strcmp(value + 1, "on") == 0) {
+                features[i].override = 1;
+            }
+            else if (strcmp(value + 1, "off") == 0) {
+                features[i].override = -1;
             }
+            else {
+                return -1;
+            }
+            return 0;
         }
     }
+    return -1;
 }
 
-
-void io_accept(ur_thread_context* context, int socket, struct sockaddr *cli_addr, socklen_t *addr_len)
+void log_features()
 {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&context->uring);
+    printf("io_uring features: \n");
 
-    io_uring_prep_accept(sqe, socket, cli_addr, addr_len, 0);
+    for (int i = 0; i < FEAT_COUNT; i++) {
+        ur_feature_info* f = &features[i];
+        const char* state;
 
-    io_connection_data *conn_data = &context->conn_pool[socket];
-    conn_data->socket = socket;
-    conn_data->state = ACCEPT;
+        if (f->enabled) {
+            state = "on";
+        }
+        else if (!f->supported) {
+            state = f->override > 0 ? "off, forced on but not supported" : "off";
+        }
+        else if (!f->implemented) {
+            state = "off, no server path uses it";
+        }
+        else {
+            state = f->override < 0 ? "off, forced off" : "off by default";
+        }
 
-    io_uring_sqe_set_data(sqe, conn_data);
+        printf("  %-20s %-15s %s \n", f->name, f->supported ? "supported" : "not supported", state);
+    }
 }
 
-void io_read(ur_thread_context* context, int socket, size_t size)
+
+// bind and listen on an AF_UNIX socket, a stale socket file from a previous run is removed
+int unix_listen(const char* path, int type)
 {
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
-    io_uring_prep_recv(sqe, socket, &context->messages_buffer[socket], size, 0);
+    struct sockaddr_un addr;
+    int sock;
 
-    io_connection_data *conn_data = &context->conn_pool[socket];
-    conn_data->socket = socket;
-    conn_data->state = READ;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("unix socket path too long: %s \n", path);
+        return -1;
+    }
 
-    io_uring_sqe_set_data(sqe, conn_data);
-}
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
 
-void io_write(ur_thread_context* context, int socket, size_t size)
-{
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&context->uring);
-    io_uring_prep_send(sqe, socket, &context->messages_buffer[socket], size, 0);
+    sock = socket(AF_UNIX, type | SOCK_NONBLOCK, 0);
 
-    io_connection_data *conn_data = &context->conn_pool[socket];
-    conn_data->socket = socket;
-    conn_data->state = WRITE;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("binding unix socket failed \n");
+        return -1;
+    }
 
-    io_uring_sqe_set_data(sqe, conn_data);
+    if (listen(sock, LISTEN_BACKLOG) < 0) {
+        perror("listening on unix socket failed\n");
+        return -1;
+    }
+
+    printf("Listening on unix %s socket %s \n", type == SOCK_SEQPACKET ? "seqpacket" : "stream", path);
+    return sock;
 }
 
 
@@ -203,24 +2449,195 @@ int main(int argc, char* argv[])
     int opt; 
     long threads = 0;
 
-    while((opt = getopt(argc, argv, "t:h")) != -1)  
+    while((opt = getopt(argc, argv, "t:usU:Q:b:w:i:Df:z:Z:q:P:E:F:B:C:Sh")) != -1)  
     {  
         switch(opt)  
         {  
             case 't':  
                 threads = strtol(optarg, NULL, 10); 
-                if (threads < 1 || threads > 64) {
+                if (threads < 1 || threads > MAX_THREADS) {
                    printf("Threads value must be > 0 and < 64 \n");
                    return 1;
                 }
                 break;  
+            case 'u':
+                server_config.udp = 1;
+                break;
+            case 's':
+                features[FEAT_MULTISHOT_RECV].override = -1;
+                break;
+            case 'U':
+                server_config.unix_stream_path = optarg;
+                break;
+            case 'Q':
+                server_config.unix_seqpacket_path = optarg;
+                break;
+            case 'b':
+                server_config.batch_count = strtol(optarg, NULL, 10);
+                if (server_config.batch_count < 1 || server_config.batch_count > IO_URING_LEN) {
+                   printf("Batch value must be > 0 and <= %i \n", IO_URING_LEN);
+                   return 1;
+                }
+                break;
+            case 'w':
+                server_config.batch_wait_usec = strtol(optarg, NULL, 10);
+                break;
+            case 'i':
+                server_config.stats_interval = strtol(optarg, NULL, 10);
+                break;
+            case 'D':
+                features[FEAT_DEFER_TASKRUN].override = 1;
+                break;
+            case 'f':
+                if (feature_override(optarg) < 0) {
+                   printf("Unknown feature override %s, expected name=on|off \n", optarg);
+                   return 1;
+                }
+                break;
+            case 'z':
+                server_config.splice_threshold = strtol(optarg, NULL, 10);
+                if (server_config.splice_threshold > CLIENT_MESSAGE_SIZE) {
+                   printf("Splice threshold must be <= %i, the copy path reads at most that much \n", CLIENT_MESSAGE_SIZE);
+                   return 1;
+                }
+                break;
+            case 'Z':
+                server_config.zc_threshold = strtol(optarg, NULL, 10);
+                break;
+            case 'q':
+                if (sscanf(optarg, "%u,%u", &server_config.iowq_bounded, &server_config.iowq_unbounded) != 2) {
+                   printf("io-wq limits are given as bounded,unbounded \n");
+                   return 1;
+                }
+                break;
+            case 'P':
+                server_config.spin_usec = strtol(optarg, NULL, 10);
+                break;
+            case 'E':
+                if (sscanf(optarg, "%u,%u", &server_config.elastic_min, &server_config.elastic_max) != 2
+                    || server_config.elastic_min < 1 || server_config.elastic_min > server_config.elastic_max
+                    || server_config.elastic_max > MAX_THREADS) {
+                   printf("Elastic thread bounds are given as min,max with 1 <= min <= max <= %i \n", MAX_THREADS);
+                   return 1;
+                }
+                break;
+            case 'F':
+                server_config.prefork = strtol(optarg, NULL, 10);
+                if (server_config.prefork < 1 || server_config.prefork > MAX_THREADS) {
+                   printf("Workers value must be > 0 and <= %i \n", MAX_THREADS);
+                   return 1;
+                }
+                break;
+            case 'B':
+                if (strcmp(optarg, "uring") == 0) {
+                   server_config.backend = BACKEND_URING;
+                }
+                else if (strcmp(optarg, "epoll") == 0) {
+                   server_config.backend = BACKEND_EPOLL;
+                }
+                else if (strcmp(optarg, "embed") == 0) {
+                   server_config.backend = BACKEND_EMBED;
+                }
+                else {
+                   printf("Unknown backend %s, expected uring, epoll or embed \n", optarg);
+                   return 1;
+                }
+                break;
+            case 'C':
+                if (sscanf(optarg, "%u,%u", &server_config.max_conns, &server_config.max_backlog) < 1) {
+                   printf("Admission limits are given as connections[,backlog] per thread \n");
+                   return 1;
+                }
+                break;
+            case 'S':
+                server_config.shed = 1;
+                break;
             case 'h':  
                 printf("usage -t: number of threads. defaults to # of CPUs in the system \n"); 
+                printf("      -u: UDP echo (datagram mode) with batched recvmsg/sendmsg and GRO/GSO \n");
+                printf("      -s: datagram mode: batched single-shot recvmsg only, same as -f multishot_recv=off \n");
+                printf("      -U: also accept on a unix SOCK_STREAM socket at this path \n");
+                printf("      -Q: also accept on a unix SOCK_SEQPACKET socket at this path. messages up to %i bytes \n", CLIENT_MESSAGE_SIZE);
+                printf("      -b: completion batch, wake up once this many CQEs are ready. needs -w \n");
+                printf("      -w: latency budget in usec, wake up after this long even if the batch isn't full \n");
+                printf("      -i: print throughput and batching stats every N seconds \n");
+                printf("      -D: single issuer rings with deferred task run, same as -f defer_taskrun=on \n");
+                printf("      -z: switch a connection to zero-copy splice echo once it echoes a payload of this many bytes. 0 = off \n");
+                printf("      -Z: payloads over %i bytes move to registered buffers, replies of this many bytes or more use SEND_ZC \n", CLIENT_MESSAGE_SIZE);
+                printf("      -q: bounded,unbounded io-wq worker caps per ring, workers pinned to the ring's CPU. 0 = kernel default \n");
+                printf("      -P: low latency: spin on the CQ this many usec before sleeping, pairs with SQPOLL \n");
+                printf("      -E: elastic ring threads min,max, added under load and retired when idle. replaces -t \n");
+                printf("      -F: prefork this many worker processes with one ring each, restarted if they die. replaces -t \n");
+                printf("      -f: feature override name=on|off, may be repeated. features are probed and logged at startup \n");
+                printf("      -C: admission control per thread: connections[,CQE backlog], 0 = no limit. accepting pauses at a limit \n");
+                printf("          and resumes under %.0f%% of them, new clients wait in the listen backlog \n", ADMISSION_RESUME * 100);
+                printf("      -S: with -C, keep accepting while paused and close new connections right away \n");
+                printf("      -B: I/O backend uring, epoll or embed. defaults to io_uring, epoll if io_uring is unavailable \n");
+                printf("          embed: rings signal an eventfd watched by an epoll loop, as inside a service with its own loop \n");
                 return 0;  
         }  
     }
 
 
+    if (server_config.batch_count > 1 && server_config.batch_wait_usec == 0) {
+        printf("a completion batch needs a latency budget (-w) \n");
+        return 1;
+    }
+
+    if (server_config.spin_usec) {
+        // completions must land in the CQ without our help, deferred task run only posts them inside a wait
+        if (features[FEAT_DEFER_TASKRUN].override > 0 || server_config.batch_wait_usec) {
+            printf("spinning (-P) can't be combined with deferred task run or completion batching \n");
+            return 1;
+        }
+        features[FEAT_DEFER_TASKRUN].override = -1;
+
+        if (features[FEAT_SQPOLL].override == 0) {
+            features[FEAT_SQPOLL].override = 1;
+        }
+    }
+
+    if (server_config.backend == BACKEND_EMBED) {
+        // the host loop only waits on the eventfd: nothing to spin on, no timeout to batch with,
+        // and deferred task run would only post CQEs inside an io_uring wait
+        if (server_config.spin_usec || server_config.batch_wait_usec || server_config.elastic_max
+            || features[FEAT_DEFER_TASKRUN].override > 0) {
+            printf("embedded rings (-B embed) can't be combined with -P, -w, -E or deferred task run \n");
+            return 1;
+        }
+        features[FEAT_DEFER_TASKRUN].override = -1;
+    }
+
+    if (server_config.prefork && server_config.elastic_max) {
+        printf("prefork workers (-F) and elastic threads (-E) are exclusive \n");
+        return 1;
+    }
+
+    if (server_config.elastic_max && (server_config.udp || server_config.splice_threshold || server_config.zc_threshold)) {
+        printf("elastic threads (-E) only hand over plain TCP/unix stream connections, not with -u, -z or -Z \n");
+        return 1;
+    }
+
+    if (server_config.splice_threshold && server_config.zc_threshold) {
+        printf("splice echo (-z) and zero-copy send (-Z) are exclusive \n");
+        return 1;
+    }
+
+    if (server_config.shed && !server_config.max_conns && !server_config.max_backlog) {
+        printf("shedding (-S) needs admission limits (-C) \n");
+        return 1;
+    }
+
+    if (server_config.udp && (server_config.max_conns || server_config.max_backlog)) {
+        printf("admission control (-C) limits stream connections, not available in datagram mode \n");
+        return 1;
+    }
+
+    if (server_config.udp && (server_config.unix_stream_path || server_config.unix_seqpacket_path)) {
+        printf("unix listeners are stream only, not available in datagram mode \n");
+        return 1;
+    }
+
     long total_cpu = sysconf(_SC_NPROCESSORS_ONLN);
 
     printf("IO_URING test echo server. \n");
@@ -229,8 +2646,89 @@ int main(int argc, char* argv[])
     if (threads == 0) {
        threads = total_cpu;
     } 
- 
-    printf("Launching with %li threads. \n", threads);
+
+    if (server_config.prefork) {
+       threads = server_config.prefork;
+       printf("Launching with %li worker processes. \n", threads);
+    }
+    else if (server_config.elastic_max) {
+       threads = server_config.elastic_max;
+       printf("Launching with %u elastic threads, up to %li. \n", server_config.elastic_min, threads);
+    }
+    else {
+       printf("Launching with %li threads. \n", threads);
+    }
+
+    int probed = server_config.backend == BACKEND_EPOLL ? -ENOSYS : probe_features();
+
+    if (probed < 0) {
+        if (server_config.backend == BACKEND_URING || server_config.backend == BACKEND_EMBED) {
+            printf("io_uring not available: %s \n", strerror(-probed));
+            return 1;
+        }
+        if (server_config.backend == BACKEND_AUTO) {
+            printf("io_uring not available (%s), falling back to epoll \n", strerror(-probed));
+        }
+
+        // the epoll backend runs the plain TCP/unix stream echo, ring features have no equivalent there
+        if (server_config.udp || server_config.splice_threshold || server_config.zc_threshold || server_config.elastic_max
+            || server_config.spin_usec || server_config.batch_wait_usec || server_config.iowq_bounded || server_config.iowq_unbounded) {
+            printf("epoll backend only runs the stream echo, not with -u, -z, -Z, -E, -P, -w or -q \n");
+            return 1;
+        }
+        backend = &epoll_backend;
+    }
+    else if (server_config.backend == BACKEND_EMBED) {
+        backend = &embed_backend;
+    }
+    printf("I/O backend: %s \n", backend->name);
+
+    // zero-copy send only runs when asked for with a threshold
+    if (!server_config.zc_threshold) {
+        features[FEAT_SEND_ZC].enabled = 0;
+    }
+    else if (!features[FEAT_SEND_ZC].enabled) {
+        printf("zero-copy send not available, -Z ignored \n");
+    }
+    else {
+        printf("Zero-copy send for replies >= %u bytes \n", server_config.zc_threshold);
+    }
+
+    // worker caps only apply when asked for
+    if (!server_config.iowq_bounded && !server_config.iowq_unbounded) {
+        features[FEAT_IOWQ_LIMITS].enabled = 0;
+    }
+    else if (features[FEAT_IOWQ_LIMITS].enabled) {
+        printf("io-wq workers per ring: %u bounded, %u unbounded \n", server_config.iowq_bounded, server_config.iowq_unbounded);
+    }
+
+    if (server_config.spin_usec) {
+        printf("Spin polling for %u usec, %s \n", server_config.spin_usec, features[FEAT_SQPOLL].enabled ? "with SQPOLL" : "without SQPOLL");
+    }
+
+    if (backend != &epoll_backend) {
+        log_features();
+    }
+
+    if (server_config.splice_threshold && !server_config.udp) {
+        printf("Splice echo for payloads >= %u bytes \n", server_config.splice_threshold);
+    }
+
+    if (server_config.max_conns || server_config.max_backlog) {
+        printf("Admission control per thread: %u connections, %u CQE backlog, %s when over \n",
+               server_config.max_conns, server_config.max_backlog, server_config.shed ? "shed" : "pause accepting");
+    }
+
+    if (server_config.batch_wait_usec) {
+        printf("Completion batching: %u CQEs or %u usec \n", server_config.batch_count, server_config.batch_wait_usec);
+    }
+
+    // shared so the supervisor sees the counters of prefork workers
+    thread_stats = mmap(NULL, sizeof(ur_thread_stats) * MAX_THREADS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (thread_stats == MAP_FAILED) {
+        perror("mmap failed for stats \n");
+        return 1;
+    }
 
 
     struct sockaddr_in srv_addr;
@@ -239,16 +2737,44 @@ int main(int argc, char* argv[])
 
     memset(&srv_addr, 0, sizeof(srv_addr));
 
-
-    // create main listening socket
-    sock_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    setsockopt(sock_listen, SOL_SOCKET, SO_REUSEADDR, &reuse_val, sizeof(reuse_val));
-
     srv_addr.sin_family = AF_INET;
     srv_addr.sin_port = htons(LISTEN_PORT);
     srv_addr.sin_addr.s_addr = INADDR_ANY;
 
 
+    //launch IO threads
+    thread_params* tp_arr;
+    pthread_t* t_ids; 
+
+    tp_arr = malloc(sizeof(thread_params) * threads);
+    t_ids = malloc(sizeof(pthread_t) * threads);    
+
+    if (server_config.udp) {
+        // one SO_REUSEPORT socket per thread, the kernel spreads flows across rings
+        for (int i=0; i<threads; i++) {
+            int sock_udp = socket(AF_INET, SOCK_DGRAM, 0);
+            setsockopt(sock_udp, SOL_SOCKET, SO_REUSEADDR, &reuse_val, sizeof(reuse_val));
+            setsockopt(sock_udp, SOL_SOCKET, SO_REUSEPORT, &reuse_val, sizeof(reuse_val));
+
+            if (setsockopt(sock_udp, SOL_UDP, UDP_GRO, &reuse_val, sizeof(reuse_val)) < 0) {
+                perror("UDP_GRO not supported \n");
+            }
+
+            if (bind(sock_udp, (struct sockaddr *)&srv_addr, sizeof(srv_addr)) < 0) {
+                perror("binding UDP socket failed \n");
+                return 1;
+            }
+
+            tp_arr[i].listener_socket = sock_udp;
+            tp_arr[i].thread_num = i;
+        }
+    }
+    else {
+
+    // create main listening socket
+    sock_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(sock_listen, SOL_SOCKET, SO_REUSEADDR, &reuse_val, sizeof(reuse_val));
+
     // bind main listening socket
     if (bind(sock_listen, (struct sockaddr *)&srv_addr, sizeof(srv_addr)) < 0) {
         perror("binding socket failed \n");
@@ -262,16 +2788,48 @@ int main(int argc, char* argv[])
     }
 
 
-    //launch IO threads
-    thread_params* tp_arr;
-    pthread_t* t_ids; 
-
-    tp_arr = malloc(sizeof(thread_params) * threads);
-    t_ids = malloc(sizeof(pthread_t) * threads);    
-
     for (int i=0; i<threads; i++) {
        tp_arr[i].listener_socket = sock_listen;
        tp_arr[i].thread_num = i;
+    }
+
+    if (server_config.unix_stream_path) {
+        int sock_unix = unix_listen(server_config.unix_stream_path, SOCK_STREAM);
+        if (sock_unix < 0) {
+            return 1;
+        }
+        server_config.unix_listeners[server_config.unix_listeners_count++] = sock_unix;
+    }
+
+    if (server_config.unix_seqpacket_path) {
+        int sock_unix = unix_listen(server_config.unix_seqpacket_path, SOCK_SEQPACKET);
+        if (sock_unix < 0) {
+            return 1;
+        }
+        server_config.unix_seqpacket_listener = sock_unix;
+        server_config.unix_listeners[server_config.unix_listeners_count++] = sock_unix;
+    }
+
+    }
+
+    // prefork mode prints them from the supervisor loop, a thread there could hold stdio across a fork
+    if (server_config.stats_interval && !server_config.prefork) {
+        pthread_t stats_id;
+        pthread_create(&stats_id, NULL, &launch_stats, (void*)threads);
+    }
+
+    if (server_config.elastic_max) {
+        printf("server running...\n");
+        launch_elastic(tp_arr);
+    }
+
+    if (server_config.prefork) {
+        printf("server running...\n");
+        fflush(stdout);
+        launch_prefork(tp_arr, threads);
+    }
+
+    for (int i=0; i<threads; i++) {
        pthread_create(&t_ids[i], NULL, &launch_uring, (void*)&tp_arr[i]);
     }    
 